@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "smalloc.h"
+
+/*
+* Slab free-slot search.  Fills slabs with tiny objects, frees one in
+* every 'stride' of them so the slabs are nearly full, and then times
+* getting those slots back with smalloc_batch() and with one smalloc()
+* per object, once for each bitmap scanner the CPU supports.
+*
+* usage: bench_bitmap [objects] [stride] [rounds]
+*/
+
+#define REQUEST_SIZE        (16)
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* names[] = {"scalar", "sse2", "avx2"};
+    size_t nobjects = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    size_t stride = argc > 2 ? strtoul(argv[2], NULL, 10) : 509;
+    int rounds = argc > 3 ? atoi(argv[3]) : 20;
+    void** ptrs;
+    void** holes;
+    size_t i, n, nholes;
+    double start, batch, single;
+    int level, used, r;
+
+    ptrs = malloc(nobjects * sizeof(void*));
+    holes = malloc((nobjects / stride + 1) * sizeof(void*));
+    if (smalloc_batch(REQUEST_SIZE, ptrs, nobjects) != nobjects) {
+        fprintf(stderr, "bench_bitmap: out of memory\n");
+        return 1;
+    }
+
+    fprintf(stdout, "%lu objects of %d bytes, one in %lu free, %d rounds\n",
+        nobjects, REQUEST_SIZE, stride, rounds);
+    fprintf(stdout, "%-8s %14s %14s\n", "scanner", "batch ns/obj",
+        "single ns/obj");
+
+    for (level = SMALLOC_SIMD_SCALAR; level <= SMALLOC_SIMD_AVX2; level++) {
+        used = smalloc_set_simd(level);
+        if (used != level) {
+            continue;
+        }
+
+        batch = single = 0.0;
+        for (r = 0; r < rounds; r++) {
+            nholes = 0;
+            for (i = 0; i < nobjects; i += stride) {
+                sfree(ptrs[i]);
+                nholes++;
+            }
+            start = now();
+            n = smalloc_batch(REQUEST_SIZE, holes, nholes);
+            batch += now() - start;
+
+            for (i = 0; i < n; i++) {
+                sfree(holes[i]);
+            }
+            start = now();
+            for (i = 0; i < n; i++) {
+                holes[i] = smalloc(REQUEST_SIZE);
+            }
+            single += now() - start;
+
+            for (i = 0; i < n; i++) {
+                ptrs[i * stride] = holes[i];
+            }
+        }
+
+        fprintf(stdout, "%-8s %14.1f %14.1f\n", names[used],
+            batch * 1e9 / (nholes * rounds), single * 1e9 / (nholes * rounds));
+    }
+
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "smalloc.h"
+
+/*
+* Large block zeroing and copying.  For block sizes from 1 MB up to
+* 'max' MB, compares memset(3) and memcpy(3) against smalloc_memzero()
+* and smalloc_memcpy(), which switch to non-temporal stores above the
+* last level cache size.  Besides bandwidth, it times a pass over a
+* small hot working set right after each operation to show how much of
+* the cache the operation evicted.
+*
+* usage: bench_copy [max MB] [rounds]
+*/
+
+#define HOT_SIZE            (1024 * 1024)
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static volatile unsigned long sink;
+
+static double touch_hot(const unsigned long* hot)
+{
+    double start = now();
+    unsigned long sum = 0;
+    size_t i;
+
+    for (i = 0; i < HOT_SIZE / sizeof(*hot); i += 8) {
+        sum += hot[i];
+    }
+    sink = sum;
+
+    return now() - start;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t max = (argc > 1 ? strtoul(argv[1], NULL, 10) : 256) << 20;
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+    unsigned long* hot;
+    char* src;
+    char* dst;
+    size_t len;
+    double t[4], h[4], start;
+    int r, k;
+
+    hot = smalloc(HOT_SIZE);
+    src = smalloc(max);
+    dst = smalloc(max);
+    if (!hot || !src || !dst) {
+        fprintf(stderr, "bench_copy: out of memory\n");
+        return 1;
+    }
+    memset(hot, 1, HOT_SIZE);
+    memset(src, 0x5A, max);
+    memset(dst, 0, max);
+
+    fprintf(stdout, "%8s | %9s %9s %9s %9s | %25s\n", "size", "memset",
+        "memzero", "memcpy", "s_memcpy", "hot set reread after (us)");
+    fprintf(stdout, "%8s | %9s %9s %9s %9s | %6s %6s %6s %6s\n", "MB",
+        "GB/s", "GB/s", "GB/s", "GB/s", "set", "zero", "cpy", "s_cpy");
+
+    for (len = 1 << 20; len <= max; len <<= 1) {
+        for (k = 0; k < 4; k++) {
+            t[k] = h[k] = 0.0;
+        }
+
+        for (r = 0; r < rounds; r++) {
+            touch_hot(hot);
+            start = now();
+            memset(dst, 0, len);
+            t[0] += now() - start;
+            h[0] += touch_hot(hot);
+
+            start = now();
+            smalloc_memzero(dst, len);
+            t[1] += now() - start;
+            h[1] += touch_hot(hot);
+
+            start = now();
+            memcpy(dst, src, len);
+            t[2] += now() - start;
+            h[2] += touch_hot(hot);
+
+            start = now();
+            smalloc_memcpy(dst, src, len);
+            t[3] += now() - start;
+            h[3] += touch_hot(hot);
+        }
+
+        if (memcmp(dst, src, len)) {
+            fprintf(stderr, "bench_copy: smalloc_memcpy corrupted data\n");
+            return 1;
+        }
+
+        fprintf(stdout, "%8lu | %9.2f %9.2f %9.2f %9.2f | %6.0f %6.0f "
+            "%6.0f %6.0f\n", len >> 20,
+            len * rounds / t[0] / 1e9, len * rounds / t[1] / 1e9,
+            len * rounds / t[2] / 1e9, len * rounds / t[3] / 1e9,
+            h[0] * 1e6 / rounds, h[1] * 1e6 / rounds,
+            h[2] * 1e6 / rounds, h[3] * 1e6 / rounds);
+    }
+
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "smalloc.h"
+
+/*
+* Small object fast path.  For each slab size class, times smalloc()
+* and sfree() of a working set of 'live' objects, allocated and freed
+* in bursts, and of a single object allocated and freed in a loop.
+* Built twice: against the regular library and against one built with
+* SMALLOC_SINGLE_THREADED, so the cost of the synchronization shows as
+* the difference between the two.
+*
+* usage: bench_fastpath [live] [rounds]
+*/
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t live = argc > 1 ? strtoul(argv[1], NULL, 10) : 4096;
+    int rounds = argc > 2 ? atoi(argv[2]) : 500;
+    void** ptrs;
+    size_t size, i;
+    double start, burst, pair;
+    int r;
+
+    ptrs = malloc(live * sizeof(void*));
+
+#ifdef SMALLOC_SINGLE_THREADED
+    fprintf(stdout, "single-threaded build, ");
+#else
+    fprintf(stdout, "thread-safe build, ");
+#endif
+    fprintf(stdout, "%lu live objects, %d rounds\n", live, rounds);
+    fprintf(stdout, "%6s %14s %14s\n", "size", "burst ns/op", "pair ns/op");
+
+    for (size = 16; size <= 256; size *= 2) {
+        start = now();
+        for (r = 0; r < rounds; r++) {
+            for (i = 0; i < live; i++) {
+                ptrs[i] = smalloc(size);
+            }
+            for (i = 0; i < live; i++) {
+                sfree(ptrs[i]);
+            }
+        }
+        burst = now() - start;
+
+        start = now();
+        for (r = 0; r < rounds; r++) {
+            for (i = 0; i < live; i++) {
+                sfree(smalloc(size));
+            }
+        }
+        pair = now() - start;
+
+        fprintf(stdout, "%6lu %14.1f %14.1f\n", size,
+            burst * 1e9 / (2.0 * live * rounds),
+            pair * 1e9 / (2.0 * live * rounds));
+    }
+
+    free(ptrs);
+
+    return 0;
+}
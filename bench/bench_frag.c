@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "smalloc.h"
+
+/*
+* Page backend fragmentation.  Runs the same random mix of large
+* allocations and frees against every page backend, each in its own
+* process since the backend can't change once something is allocated,
+* and reports how much memory the page groups held on to and how broken
+* up the backend's free space ended up.
+*
+* usage: bench_frag [ops] [live blocks] [max pages]
+*/
+
+static const char* names[] = {"mmap", "buddy", "span"};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t pick_size(unsigned* seed, size_t maxpages, size_t pagesize)
+{
+    size_t pages;
+
+    /* Mostly small runs with a long tail of big ones. */
+    pages = 1 + rand_r(seed) % maxpages;
+    pages = 1 + pages * pages / maxpages * pages / maxpages;
+    return pages * pagesize - rand_r(seed) % pagesize;
+}
+
+static int run(int backend, unsigned long ops, size_t nlive, size_t maxpages)
+{
+    struct smalloc_stats st;
+    size_t pagesize, peak, live, i;
+    unsigned seed = 12345;
+    unsigned long op;
+    double start, secs;
+    char** ptrs;
+    size_t* sizes;
+
+    pagesize = sysconf(_SC_PAGESIZE);
+    if (smalloc_set_backend(backend)) {
+        fprintf(stdout, "%-8s unsupported\n", names[backend]);
+        return 0;
+    }
+
+    ptrs = calloc(nlive, sizeof(*ptrs));
+    sizes = calloc(nlive, sizeof(*sizes));
+    peak = live = 0;
+
+    start = now();
+    for (op = 0; op < ops; op++) {
+        i = rand_r(&seed) % nlive;
+        if (ptrs[i]) {
+            sfree(ptrs[i]);
+            ptrs[i] = NULL;
+            live -= sizes[i];
+        } else {
+            sizes[i] = pick_size(&seed, maxpages, pagesize);
+            ptrs[i] = smalloc(sizes[i]);
+            if (ptrs[i] == NULL) {
+                fprintf(stderr, "bench_frag: out of memory\n");
+                return 1;
+            }
+            ptrs[i][0] = ptrs[i][sizes[i] - 1] = 1;
+            live += sizes[i];
+        }
+
+        smalloc_stats(&st);
+        if (st.bytes_mapped > peak) {
+            peak = st.bytes_mapped;
+        }
+    }
+    secs = now() - start;
+
+    smalloc_stats(&st);
+    fprintf(stdout, "%-8s %10.0f %9.1f %9.1f %9.1f %7.3f %9.1f %9.1f %6.1f%%\n",
+        names[backend], ops / secs, live / 1048576.0,
+        st.bytes_mapped / 1048576.0, peak / 1048576.0,
+        live ? (double)st.bytes_mapped / live : 0.0,
+        st.bytes_reserved / 1048576.0,
+        st.bytes_extent_free / 1048576.0,
+        st.bytes_extent_free ?
+        100.0 * (1.0 - (double)st.largest_extent_free /
+        st.bytes_extent_free) : 0.0);
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned long ops = argc > 1 ? strtoul(argv[1], NULL, 10) : 50000;
+    size_t nlive = argc > 2 ? strtoul(argv[2], NULL, 10) : 2048;
+    size_t maxpages = argc > 3 ? strtoul(argv[3], NULL, 10) : 64;
+    int backend, status;
+    pid_t pid;
+
+    fprintf(stdout, "%lu ops, %lu live blocks, up to %lu pages each\n",
+        ops, nlive, maxpages);
+    fprintf(stdout, "%-8s %10s %9s %9s %9s %7s %9s %9s %7s\n", "backend",
+        "ops/s", "live MB", "mapped MB", "peak MB", "mapped/", "resv MB",
+        "free MB", "ext");
+    fprintf(stdout, "%-8s %10s %9s %9s %9s %7s %9s %9s %7s\n", "", "", "",
+        "", "", "live", "", "", "frag");
+
+    for (backend = SMALLOC_BACKEND_MMAP; backend <= SMALLOC_BACKEND_SPAN;
+        backend++) {
+        fflush(stdout);
+        pid = fork();
+        if (pid == 0) {
+            return run(backend, ops, nlive, maxpages);
+        }
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || status != 0) {
+            fprintf(stderr, "bench_frag: %s run failed\n", names[backend]);
+            return 1;
+        }
+    }
+
+    return 0;
+}
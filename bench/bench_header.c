@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "smalloc.h"
+
+/*
+* Page group header layout.  Times the paths that do little but read and
+* write page group headers, and counts their L1 data cache and last
+* level cache misses through perf_event_open(2) where the kernel and CPU
+* provide them:
+*
+* slab free - frees 'objects' slab objects in random order, so that
+*     nearly every free lands in another slab's header.
+* slab alloc - allocates them again.
+* group walk - looks up a chunk in the last of 'groups' chunk groups,
+*     which walks the page group list through every one of them.
+*
+* usage: bench_header [objects] [groups] [rounds]
+*/
+
+#define SLAB_SIZE           (256)
+#define CHUNK_SIZE          (20000)
+
+#define NCOUNTERS           (2)
+
+static int counters[NCOUNTERS] = {-1, -1};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void counters_open(void)
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+    int i;
+
+    for (i = 0; i < NCOUNTERS; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        if (i == 0) {
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        } else {
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        }
+        counters[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+}
+
+static void counters_start(void)
+{
+#ifdef __linux__
+    int i;
+
+    for (i = 0; i < NCOUNTERS; i++) {
+        if (counters[i] >= 0) {
+            ioctl(counters[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+static void counters_stop(long long* out)
+{
+    int i;
+
+    for (i = 0; i < NCOUNTERS; i++) {
+        out[i] = -1;
+#ifdef __linux__
+        if (counters[i] >= 0) {
+            ioctl(counters[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(counters[i], &out[i], sizeof(out[i])) !=
+                sizeof(out[i])) {
+                out[i] = -1;
+            }
+        }
+#endif
+    }
+}
+
+static void report(const char* name, double secs, const long long* misses,
+    size_t ops)
+{
+    char l1[32], llc[32];
+
+    if (misses[0] < 0) {
+        strcpy(l1, "-");
+    } else {
+        snprintf(l1, sizeof(l1), "%.3f", (double)misses[0] / ops);
+    }
+    if (misses[1] < 0) {
+        strcpy(llc, "-");
+    } else {
+        snprintf(llc, sizeof(llc), "%.3f", (double)misses[1] / ops);
+    }
+    fprintf(stdout, "%-12s %10.1f %12s %12s\n", name, secs * 1e9 / ops, l1,
+        llc);
+}
+
+int main(int argc, char* argv[])
+{
+    size_t nobjects = argc > 1 ? strtoul(argv[1], NULL, 10) : 500000;
+    size_t ngroups = argc > 2 ? strtoul(argv[2], NULL, 10) : 4096;
+    int rounds = argc > 3 ? atoi(argv[3]) : 5;
+    long long misses[NCOUNTERS], sum[3][NCOUNTERS];
+    double start, secs[3];
+    unsigned seed = 1;
+    void** ptrs;
+    void** groups;
+    void* tmp;
+    size_t i, j, lookups;
+    int r, c;
+
+    ptrs = malloc(nobjects * sizeof(void*));
+    groups = malloc(ngroups * sizeof(void*));
+    counters_open();
+
+    for (i = 0; i < ngroups; i++) {
+        groups[i] = smalloc(CHUNK_SIZE);
+        if (groups[i] == NULL) {
+            fprintf(stderr, "bench_header: out of memory\n");
+            return 1;
+        }
+    }
+    if (smalloc_batch(SLAB_SIZE, ptrs, nobjects) != nobjects) {
+        fprintf(stderr, "bench_header: out of memory\n");
+        return 1;
+    }
+
+    fprintf(stdout, "%lu objects of %d bytes, %lu chunk groups, %d rounds%s\n",
+        nobjects, SLAB_SIZE, ngroups, rounds,
+        counters[0] < 0 && counters[1] < 0 ? ", no cache counters" : "");
+    fprintf(stdout, "%-12s %10s %12s %12s\n", "path", "ns/op",
+        "L1D miss/op", "LLC miss/op");
+
+    memset(secs, 0, sizeof(secs));
+    memset(sum, 0, sizeof(sum));
+    lookups = nobjects / 16;
+    for (r = 0; r < rounds; r++) {
+        for (i = nobjects - 1; i > 0; i--) {
+            j = rand_r(&seed) % (i + 1);
+            tmp = ptrs[i];
+            ptrs[i] = ptrs[j];
+            ptrs[j] = tmp;
+        }
+
+        counters_start();
+        start = now();
+        for (i = 0; i < nobjects; i++) {
+            sfree(ptrs[i]);
+        }
+        secs[0] += now() - start;
+        counters_stop(misses);
+        for (c = 0; c < NCOUNTERS; c++) {
+            sum[0][c] += misses[c];
+        }
+
+        counters_start();
+        start = now();
+        for (i = 0; i < nobjects; i++) {
+            ptrs[i] = smalloc(SLAB_SIZE);
+        }
+        secs[1] += now() - start;
+        counters_stop(misses);
+        for (c = 0; c < NCOUNTERS; c++) {
+            sum[1][c] += misses[c];
+        }
+
+        /* Growing a chunk to its own size only has to find its group. */
+        counters_start();
+        start = now();
+        for (i = 0; i < lookups; i++) {
+            srealloc(groups[ngroups - 1], CHUNK_SIZE);
+        }
+        secs[2] += now() - start;
+        counters_stop(misses);
+        for (c = 0; c < NCOUNTERS; c++) {
+            sum[2][c] += misses[c];
+        }
+    }
+
+    for (c = 0; c < NCOUNTERS; c++) {
+        if (counters[c] < 0) {
+            sum[0][c] = sum[1][c] = sum[2][c] = -1;
+        }
+    }
+    report("slab free", secs[0], sum[0], nobjects * rounds);
+    report("slab alloc", secs[1], sum[1], nobjects * rounds);
+    report("group walk", secs[2] / ngroups, sum[2], lookups * rounds);
+
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "smalloc.h"
+
+/*
+* Metadata footprint.  For each object size, allocates 'count' objects
+* in a fresh process and reports how many bytes the heap mapped beyond
+* the bytes asked for, per live object: chunk and page group headers,
+* slab bitmaps, alignment padding and the unused tail of the last group.
+* Built twice: against the regular library and against one built with
+* SMALLOC_COMPACT, so the saving shows as the difference between the two.
+*
+* usage: bench_overhead [count]
+*/
+
+static const size_t sizes[] = {8, 16, 24, 48, 128, 256, 1000, 4000};
+
+static int run(size_t size, size_t count)
+{
+    struct smalloc_stats st;
+    size_t i, base;
+    char* p;
+
+    smalloc_stats(&st);
+    base = st.bytes_mapped;
+    for (i = 0; i < count; i++) {
+        p = smalloc(size);
+        if (p == NULL) {
+            fprintf(stderr, "bench_overhead: out of memory\n");
+            return 1;
+        }
+        p[0] = p[size - 1] = 1;
+    }
+
+    smalloc_stats(&st);
+    fprintf(stdout, "%6lu %12lu %12lu %12.2f %9.1f%%\n", size, count * size,
+        st.bytes_mapped - base,
+        (double)(st.bytes_mapped - base - count * size) / count,
+        100.0 * (st.bytes_mapped - base - count * size) /
+        (st.bytes_mapped - base));
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000;
+    int status;
+    size_t i;
+    pid_t pid;
+
+#ifdef SMALLOC_COMPACT
+    fprintf(stdout, "compact build, ");
+#else
+    fprintf(stdout, "regular build, ");
+#endif
+    fprintf(stdout, "%lu live objects\n", count);
+    fprintf(stdout, "%6s %12s %12s %12s %10s\n", "size", "asked", "mapped",
+        "bytes/object", "overhead");
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        fflush(stdout);
+        pid = fork();
+        if (pid == 0) {
+            return run(sizes[i], count);
+        }
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || status != 0) {
+            fprintf(stderr, "bench_overhead: %lu byte run failed\n",
+                sizes[i]);
+            return 1;
+        }
+    }
+
+    return 0;
+}
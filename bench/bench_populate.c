@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "smalloc.h"
+
+/*
+* First-touch cost of a huge allocation.  Times writing a freshly
+* allocated table of 'size' MB single-threaded, taking every page fault
+* inline, against prefaulting it with smalloc_populate() on 1, 2, 4, ...
+* threads first and then writing it.
+*
+* usage: bench_populate [size MB] [max threads]
+*/
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t len = (argc > 1 ? strtoul(argv[1], NULL, 10) : 1024) << 20;
+    long maxthreads = argc > 2 ? atol(argv[2]) :
+        sysconf(_SC_NPROCESSORS_ONLN);
+    double start, populate, write;
+    char* table;
+    long n;
+
+    fprintf(stdout, "%lu MB table, %ld CPUs online\n", len >> 20,
+        sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(stdout, "%-18s %12s %12s %12s\n", "", "populate ms", "write ms",
+        "total ms");
+
+    table = smalloc(len);
+    if (table == NULL) {
+        fprintf(stderr, "bench_populate: out of memory\n");
+        return 1;
+    }
+    start = now();
+    memset(table, 1, len);
+    write = now() - start;
+    sfree(table);
+    fprintf(stdout, "%-18s %12s %12.1f %12.1f\n", "first touch", "-",
+        write * 1e3, write * 1e3);
+
+    for (n = 1; n <= maxthreads; n *= 2) {
+        table = smalloc(len);
+        if (table == NULL) {
+            fprintf(stderr, "bench_populate: out of memory\n");
+            return 1;
+        }
+
+        start = now();
+        smalloc_populate(table, len, (int)n);
+        populate = now() - start;
+
+        start = now();
+        memset(table, 1, len);
+        write = now() - start;
+        sfree(table);
+
+        fprintf(stdout, "populate %3ld thr   %12.1f %12.1f %12.1f\n", n,
+            populate * 1e3, write * 1e3, (populate + write) * 1e3);
+    }
+
+    return 0;
+}
@@ -9,9 +9,319 @@
   #include <unistd.h>
 #endif
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+* Contention counters kept for each of the allocator's internal locks.
+* 'contended' counts acquisitions that found the lock already held and
+* 'wait_ns' is the total time those acquisitions spent waiting for it.
+*/
+struct smalloc_lock_stats {
+    unsigned long acquisitions;
+    unsigned long contended;
+    unsigned long long wait_ns;
+};
+
+/*
+* Live chunks are also counted by size class: class 0 holds chunks of up
+* to 16 bytes, each following class chunks up to twice the size of the
+* previous one, and the last class everything bigger.  'npurged' and
+* 'bytes_purged' count page groups handed back to the OS.
+* 'pages_prefaulted' counts pages populated ahead of the bump pointer.
+* 'bytes_reserved' is the address space reserved by the page backend,
+* 'bytes_extent_free' how much of it is free, and 'largest_extent_free'
+* the biggest run of free pages in it.
+* 'bytes_pooled' is held by empty slabs waiting to be reused by any size
+* class, and 'bytes_pooled_dirty' is the part of it not yet purged.
+* 'bytes_tagged' breaks the allocated bytes down by smalloc_tagged() tag;
+* plain smalloc() allocations are counted under tag 0.
+* Small objects come from 'narenas' arenas, each with its own lock;
+* 'arena_threads' is how many threads are currently mapped to each one
+* and 'arena_lock' its lock counters.
+*/
+#define SMALLOC_STATS_NCLASSES  (16)
+#define SMALLOC_STATS_NTAGS     (16)
+#define SMALLOC_STATS_NARENAS   (8)
+
+struct smalloc_stats {
+    size_t bytes_mapped;
+    size_t bytes_allocated;
+    size_t npagegroups;
+    size_t nchunks;
+    size_t nchunks_class[SMALLOC_STATS_NCLASSES];
+    size_t bytes_tagged[SMALLOC_STATS_NTAGS];
+    unsigned long long nallocs;
+    unsigned long long nfrees;
+    unsigned long long npurged;
+    unsigned long long bytes_purged;
+    unsigned long long pages_prefaulted;
+    size_t bytes_reserved;
+    size_t bytes_extent_free;
+    size_t largest_extent_free;
+    size_t bytes_pooled;
+    size_t bytes_pooled_dirty;
+    struct smalloc_lock_stats heap_lock;
+    unsigned narenas;
+    size_t arena_threads[SMALLOC_STATS_NARENAS];
+    struct smalloc_lock_stats arena_lock[SMALLOC_STATS_NARENAS];
+};
+
+/*
+* Layout of the shared memory segment written by smalloc_shm_export().
+* A reader copies the segment and retries until 'seq' is even and the
+* same before and after the copy.
+*/
+#define SMALLOC_SHM_MAGIC       (0x534d4c43)
+#define SMALLOC_SHM_VERSION     (6)
+#define SMALLOC_SHM_NAME_FMT    "/smalloc.%ld"
+
+struct smalloc_shm_segment {
+    unsigned magic;
+    unsigned version;
+    volatile unsigned seq;
+    unsigned interval_ms;
+    long pid;
+    unsigned long long timestamp_ns;
+    size_t rss_bytes;
+    struct smalloc_stats stats;
+};
+
 void *smalloc(size_t size);
 void  sfree(void *ptr);
 void *scalloc(size_t nmemb, size_t size);
 void *srealloc(void* ptr, size_t size);
 
+/*
+* Allocates like smalloc() but charges the memory to 'tag' in the
+* statistics.  'tag' must be below SMALLOC_STATS_NTAGS.
+*/
+void *smalloc_tagged(size_t size, unsigned tag);
+
+/*
+* Allocates 'n' objects that live and die together as one chunk, laid
+* out back to back.  Object 'i' is 'sizes[i]' bytes aligned to
+* 'aligns[i]', a power of two, or to the usual alignment when 'aligns'
+* is NULL or 'aligns[i]' is 0; its address is stored in 'ptrs[i]'.
+* Returns the pointer to pass to sfree() to release them all, which is
+* 'ptrs[0]' unless an alignment above the usual one needed padding, or
+* NULL.
+*/
+void *smalloc_multi(const size_t *sizes, const size_t *aligns, size_t n,
+          void **ptrs);
+
+/*
+* Allocates up to 'count' objects of 'size' bytes into 'ptrs' in one go.
+* Returns how many were allocated, which is less than 'count' only when
+* memory runs out.  Each object is released with sfree() as usual.
+*/
+size_t smalloc_batch(size_t size, void **ptrs, size_t count);
+
+/*
+* Mark/release stack allocators for strictly nested scopes.  Allocation
+* bumps a pointer; smalloc_stack_release() frees everything allocated
+* since 'mark' at once, in constant time.  Objects can't be freed on
+* their own and must not be passed to sfree().  The pages of deeper
+* scopes are kept and reused until smalloc_stack_destroy().  A stack
+* must only be used by one thread at a time.
+*/
+struct smalloc_stack;
+
+struct smalloc_stack_mark {
+    void* group;
+    void* top;
+};
+
+struct smalloc_stack* smalloc_stack_create(void);
+void *smalloc_stack_alloc(struct smalloc_stack* st, size_t size);
+struct smalloc_stack_mark smalloc_stack_mark(struct smalloc_stack* st);
+void  smalloc_stack_release(struct smalloc_stack* st,
+          struct smalloc_stack_mark mark);
+void  smalloc_stack_destroy(struct smalloc_stack* st);
+
+/*
+* Redirects the calling thread's smalloc(), scalloc(), srealloc() and
+* smalloc_batch() to the stack allocator 'heap', or back to the heap if
+* 'heap' is NULL, and returns the previous setting so that scopes can
+* nest.  sfree() of an object in 'heap' does nothing and srealloc() of
+* one copies it, whichever heap is current and on whichever thread, so
+* objects can be passed out of nested scopes.  Everything in 'heap' is
+* released together with smalloc_stack_release() or
+* smalloc_stack_destroy(), after which none of it may be freed again.  A
+* stack used as a heap is not to be allocated from directly as well.
+*/
+struct smalloc_stack* smalloc_thread_set_heap(struct smalloc_stack* heap);
+
+/*
+* Per-thread frame allocator for data that lives for one tick of a loop.
+* smalloc_frame_alloc() allocates from the current frame, which
+* smalloc_frame_next() ends.  Each thread has two buffers used for
+* alternate frames, so what was allocated in the previous frame stays
+* valid for the whole of the next one, and is freed all at once when the
+* one after that starts.  The buffers grow as frames need and shrink
+* back after quiet periods.  smalloc_frame_free() releases the calling
+* thread's buffers; threads that exit release theirs automatically.
+*/
+void *smalloc_frame_alloc(size_t size);
+void  smalloc_frame_next(void);
+void  smalloc_frame_free(void);
+
+/*
+* FIFO ring allocators for queued messages, with room for at least
+* 'size' bytes of messages and their 16 byte headers.  Allocation bumps
+* the head of the ring and freeing the oldest message advances its
+* tail; messages freed out of order are reclaimed once the tail reaches
+* them.  smalloc_ring_alloc() returns NULL when the ring is full.  One
+* thread may allocate while another frees.
+*/
+struct smalloc_ring;
+
+struct smalloc_ring* smalloc_ring_create(size_t size);
+void *smalloc_ring_alloc(struct smalloc_ring* r, size_t size);
+void  smalloc_ring_free(struct smalloc_ring* r, void *ptr);
+void  smalloc_ring_destroy(struct smalloc_ring* r);
+
+/*
+* Allocation for C++20 coroutine frames; see smalloc_coro.hpp for the
+* promise_type hook.  Frames come from per-thread caches of size classed
+* free lists, so allocating one is usually a list pop.  A frame may be
+* freed on any thread: frames freed away from the thread that allocated
+* them are handed back to that thread's cache.
+*/
+void *smalloc_coro_alloc(size_t size);
+void  smalloc_coro_free(void *ptr);
+
+/*
+* Instruction set used to scan slab bitmaps.  The best one the CPU
+* supports is picked at start up; smalloc_set_simd() selects a lower
+* one, mostly for benchmarking, and returns the level actually in use.
+*/
+#define SMALLOC_SIMD_SCALAR     (0)
+#define SMALLOC_SIMD_SSE2       (1)
+#define SMALLOC_SIMD_AVX2       (2)
+
+int   smalloc_set_simd(int level);
+
+/*
+* Has the background thread keep 'npages' pages past the bump pointer of
+* every page group populated, so that new chunks don't take page faults
+* on the caller's critical path.  Zero turns prefaulting off.
+*/
+int   smalloc_set_prefault(size_t npages);
+
+/*
+* Prefaults every page of [ptr, ptr + len) using 'nthreads' threads, or
+* one per online CPU if 'nthreads' is zero, so that a huge allocation
+* is populated at the speed of the memory system rather than one page
+* fault at a time.  The contents of the range are left untouched.
+* Returns -1 with errno set if part of the range isn't mapped writable.
+*/
+int   smalloc_populate(void *ptr, size_t len, int nthreads);
+
+/*
+* memset(dst, 0, len) and memcpy(dst, src, len) as used by scalloc() and
+* srealloc().  Above the size of the last level cache they stream the
+* data past the cache with non-temporal stores.
+*/
+void  smalloc_memzero(void *dst, size_t len);
+void  smalloc_memcpy(void *dst, const void *src, size_t len);
+
+/*
+* Deferred frees.  The pointers are queued for a background reclaimer
+* thread and the call returns immediately.  sfree_async_flush() blocks
+* until everything queued so far has actually been freed.
+*/
+void  sfree_async(void *ptr);
+void  sfree_async_bulk(void **ptrs, size_t count);
+void  sfree_async_flush(void);
+
+/*
+* Where page groups get their pages from.  SMALLOC_BACKEND_MMAP maps
+* every page group separately.  SMALLOC_BACKEND_BUDDY carves them out of
+* large reserved regions with a binary buddy allocator, which rounds
+* them up to a power of two pages and merges neighbours as they are
+* released.  SMALLOC_BACKEND_SPAN carves them out of the same kind of
+* regions as a page heap, best fit by length and lowest address first,
+* coalescing any free neighbours on release.  The backend can only be
+* changed before the first allocation.
+*/
+#define SMALLOC_BACKEND_MMAP    (0)
+#define SMALLOC_BACKEND_BUDDY   (1)
+#define SMALLOC_BACKEND_SPAN    (2)
+
+/*
+* Or'ed into SMALLOC_BACKEND_BUDDY or SMALLOC_BACKEND_SPAN, backs the
+* regions with memfds, which makes the heap an arena that can be
+* snapshotted.  Page groups bigger than a region can't be allocated.
+*/
+#define SMALLOC_BACKEND_MEMFD   (0x100)
+
+int   smalloc_set_backend(int backend);
+
+/*
+* Copy-on-write snapshots of a memfd-backed heap.  smalloc_arena_snapshot()
+* takes a restore point by remapping the heap's regions MAP_PRIVATE, so
+* the pages written after it are copied on first write.
+* smalloc_arena_rollback() returns every allocation, and the contents of
+* every page of the heap, to how they were at the restore point by
+* dropping those copies, which costs only the pages actually modified;
+* the restore point is kept for further rollbacks.
+* smalloc_arena_commit() drops the restore point, keeping the heap as it
+* is now, which copies the pages in use.  Memory allocated after the
+* restore point, including stacks, rings and per-thread caches, must not
+* be used after a rollback.  Only one restore point can be held at a time.
+*/
+int   smalloc_arena_snapshot(void);
+int   smalloc_arena_rollback(void);
+int   smalloc_arena_commit(void);
+
+/*
+* What a child process does with the page groups it inherits from fork(2).
+* SMALLOC_FORK_SHARE, the default, keeps allocating from them.
+* SMALLOC_FORK_FRESH sets them aside: the child allocates only from new
+* page groups and frees into inherited ones are ignored, so the parent's
+* pages stay copy-on-write shared with the child.
+*/
+#define SMALLOC_FORK_SHARE      (0)
+#define SMALLOC_FORK_FRESH      (1)
+
+int   smalloc_set_fork_policy(int policy);
+
+/*
+* Fixes the number of small-object arenas at 'n', up to
+* SMALLOC_STATS_NARENAS, moving threads and the slabs of dropped arenas
+* over to the remaining ones.  By default, and again after passing 0,
+* the count follows lock contention: more arenas while threads keep
+* colliding on them, fewer once they stop.
+*/
+int   smalloc_set_arenas(unsigned n);
+
+/*
+* Sets how long, in milliseconds, an empty slab waits in the pool for
+* another size class to reuse it before its pages are given back to the
+* OS.  Zero gives them back as soon as the slab empties.  Slabs that are
+* already waiting longer than that are purged at once.
+*/
+int   smalloc_set_decay(unsigned ms);
+
+/*
+* Fills in 'st' with a consistent snapshot of the allocator's counters.
+* It never takes an allocator lock, so it is safe to poll frequently
+* from a monitoring thread.
+*/
+int   smalloc_stats(struct smalloc_stats *st);
+
+/*
+* Publishes the statistics every 'interval_ms' milliseconds into the
+* shared memory segment 'name', for smalloc-top to display.  A NULL name
+* uses SMALLOC_SHM_NAME_FMT with the process id.
+*/
+int   smalloc_shm_export(const char *name, unsigned interval_ms);
+void  smalloc_shm_unexport(void);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
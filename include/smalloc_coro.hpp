@@ -0,0 +1,62 @@
+#ifndef SMALLOC_CORO_HPP
+#define SMALLOC_CORO_HPP
+
+#include <cstddef>
+#include <new>
+
+#include "smalloc.h"
+
+/*
+* Base class for C++20 coroutine promise types.  The compiler allocates a
+* coroutine's frame through its promise type's operator new, so deriving
+* the promise from this class puts frames in smalloc's per-thread frame
+* caches:
+*
+*   struct task {
+*       struct promise_type : smalloc_coro_frame {
+*           ...
+*       };
+*   };
+*
+* A promise type that declares get_return_object_on_allocation_failure()
+* derives from smalloc_coro_frame_nothrow instead.  The compiler still
+* calls operator new(std::size_t) but requires it to be noexcept, and a
+* null return makes the coroutine return that object rather than throw
+* std::bad_alloc.
+*/
+struct smalloc_coro_frame {
+    static void* operator new(std::size_t size)
+    {
+        void* ptr = smalloc_coro_alloc(size);
+
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    static void* operator new(std::size_t size,
+        const std::nothrow_t&) noexcept
+    {
+        return smalloc_coro_alloc(size);
+    }
+
+    static void operator delete(void* ptr, std::size_t) noexcept
+    {
+        smalloc_coro_free(ptr);
+    }
+};
+
+struct smalloc_coro_frame_nothrow {
+    static void* operator new(std::size_t size) noexcept
+    {
+        return smalloc_coro_alloc(size);
+    }
+
+    static void operator delete(void* ptr, std::size_t) noexcept
+    {
+        smalloc_coro_free(ptr);
+    }
+};
+
+#endif
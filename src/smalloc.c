@@ -5,6 +5,99 @@
   #include <stdio.h>
 #endif
 
+#ifndef _WIN32
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <pthread.h>
+  #include <sched.h>
+  #include <stdio.h>
+  #include <stdlib.h>
+  #include <sys/stat.h>
+  #include <time.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __linux__
+  #include <linux/futex.h>
+  #include <sys/syscall.h>
+#endif
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE     (23)
+#endif
+
+#ifdef __linux__
+  #ifndef MAP_FIXED_NOREPLACE
+  #define MAP_FIXED_NOREPLACE   (0x100000)
+  #endif
+  #ifndef MREMAP_MAYMOVE
+  #define MREMAP_MAYMOVE        (1)
+  #endif
+  #ifndef MFD_CLOEXEC
+  #define MFD_CLOEXEC           (1)
+  #endif
+#endif
+
+/*
+* SMALLOC_SINGLE_THREADED builds the allocator for programs that only
+* ever call it from one thread.  Locks, sequence locks, thread-local
+* storage, thread exit hooks and the handling of frees from other
+* threads all compile away.  Whatever needs a thread of its own works as
+* it does on Windows: sfree_async() frees at once, and neither
+* prefaulting ahead nor the shared memory export are available.
+* smalloc_populate() runs on the calling thread alone.
+*/
+#if !defined(_WIN32) && !defined(SMALLOC_SINGLE_THREADED)
+  #define _SMALLOC_THREADS
+#endif
+
+#if defined(SMALLOC_SINGLE_THREADED)
+  #define _SMALLOC_TLS
+#elif defined(_MSC_VER)
+  #define _SMALLOC_TLS          __declspec(thread)
+#else
+  #define _SMALLOC_TLS          __thread
+#endif
+
+/*
+* Loads, stores and fences on memory other threads read without a lock.
+* Without other threads they are ordinary accesses.  Read-modify-write
+* operations are confined to code that single-threaded builds leave out,
+* or have a macro of their own, like _pool_cas().
+*/
+#ifdef SMALLOC_SINGLE_THREADED
+  #define _atomic_load(p, order)        (*(p))
+  #define _atomic_store(p, v, order)    ((void)(*(p) = (v)))
+  #define _atomic_fence(order)          ((void)0)
+#else
+  #define _atomic_load(p, order)        __atomic_load_n(p, order)
+  #define _atomic_store(p, v, order)    __atomic_store_n(p, v, order)
+  #define _atomic_fence(order)          __atomic_thread_fence(order)
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define _SMALLOC_X86
+  #include <immintrin.h>
+#endif
+
+/*
+* SMALLOC_COMPACT trims the allocator's own memory use for constrained
+* targets.  Sizes, counts and offsets in the page group and chunk
+* headers are 32 bits wide, so no page group can grow past 4 GB.  Chunks
+* keep only their length and freed flag.  Page groups and slabs default
+* to two pages and objects to 8 byte alignment, and the statistics only
+* count mapped memory, never individual objects.
+*/
+#ifdef SMALLOC_COMPACT
+typedef uint32_t _smalloc_size_t;
+#define _SMALLOC_SIZE_MAX       ((size_t)UINT32_MAX)
+#else
+typedef size_t _smalloc_size_t;
+#define _SMALLOC_SIZE_MAX       ((size_t)-1)
+#endif
+
 /*
 * The actual chunks of memory that are given to the calling function.
 * Enough memory will be used to fulfill the request, plus store the
@@ -18,44 +111,124 @@
 * next - the next chunk.  This is a list whose limit is the number of
 *     allocations that can fit within a page group.
 *
+* SMALLOC_COMPACT builds keep neither 'ptr', which always follows the
+* header, nor the list.
+*
 * |---------------------- total chunk memory ---------------------------|
 * |-- chunk metadata ---|------------------ user memory ----------------|
 *
 */
 struct _smalloc_chunk_t {
+#ifndef SMALLOC_COMPACT
     void *ptr;
-    size_t len;
+#endif
+    _smalloc_size_t len;
     unsigned freed;
+#ifndef SMALLOC_COMPACT
     struct _smalloc_chunk_t* next;
+#endif
 };
 
 /*
 * This structure represents a group of pages that the allocator can
 * allocate smaller chunks from.
 *
-* top - The start of the memory available for 'chunking'.
+* The whole structure fits one cache line on 64 bit targets.  The fields
+* every allocation or free reads come first; which of them a group uses
+* depends on its kind, so most of the line is shared between kinds.  The
+* one field only touched when the group is prefaulted comes last.
+*
+* next - the next page group.
 * npages - The number of pages allocated for this group.  This data
 *     structure occupies the first few pages of that group of pages.
-* lenbytes - The number of bytes in this page group, minus the space
-*     taken by this structure.
+*     The bytes after it are _SMALLOC_PGLEN(pg).
+* nlive - The number of chunks handed out from this group that have not
+*     been freed yet.  Chunks are carved off 'top' and are not reused
+*     individually; once 'nlive' drops to zero the whole group is reset.
+* tag - The accounting tag every chunk in this group was allocated under
+*     (see smalloc_tagged).  Keeping it here rather than in each chunk
+*     lets sfree() attribute a chunk to its tag at no per-chunk cost.
+* kind - _SMALLOC_PG_CHUNKS for a group chunks are carved from,
+*     _SMALLOC_PG_SLAB for a slab of equally sized slots,
+*     _SMALLOC_PG_STACK for a group owned by a stack allocator,
+*     _SMALLOC_PG_RING for the buffer of a ring allocator, or
+*     _SMALLOC_PG_POOL for an empty slab waiting in the pool.
+*
+* Groups of every kind but slabs then have:
+*
+* top - The start of the memory available for 'chunking'.
 * bytesfree - The total number of bytes free that can be allocated to
 *     a calling function.
-* chunks - a singly linked list of the allocated chunks in this page group.
-* next - the next page group.
+* chunks - a singly linked list of the allocated chunks in this page
+*     group, not kept by SMALLOC_COMPACT builds.
+* hiwater - the offset of the highest 'top' has ever been.  Memory past
+*     it has never been handed out and is still zeroed, as it came from
+*     the OS.
 *
 * |------------------------- raw page group ----------------------------|
 * |-- metadata --|--------------------- chunks -------------------------|
 *
+* A slab hands out small objects of a single size class without any
+* per-object header.  For slabs 'nlive' counts the slots in use, and:
+*
+* slabnext - the next slab of the same size class, or in the pool the
+*     next group in the pool.
+* arena - the arena the slab belongs to.  It changes when the slab moves
+*     to another arena along with its list, under the heap lock, or when
+*     another arena takes it from the pool.
+* slotsize - the size of every slot in the slab.
+* nslots - the number of slots in the slab.
+* hint - index of the first bitmap word that may have a free slot.  In
+*     the pool, the time in milliseconds the group went in, or 0 once its
+*     pages have been purged.
+* slots - the offset of the first slot.  The bitmap, one bit per slot set
+*     while the slot is free, sits right after this structure.
+*
+* |------------------------- raw page group ----------------------------|
+* |-- metadata --|-- bitmap --|-------------- slots --------------------|
+*
+* And the cold field:
+*
+* prefaulted - the offset of the end of the pages past 'top' that the
+*     background thread has already populated (see smalloc_set_prefault).
+*
+* Offsets are from the start of the group, so they stay valid when the
+* group moves.
 */
 struct _smalloc_pagegroup_t {
-    void* top;
-    size_t npages;
-    size_t lenbytes;
-    size_t bytesfree;
-    struct _smalloc_chunk_t* chunks;
     struct _smalloc_pagegroup_t* next;
+    _smalloc_size_t nlive;
+    uint32_t npages;
+    unsigned short tag;
+    unsigned short kind;
+    union {
+        struct {
+            void* top;
+            _smalloc_size_t bytesfree;
+#ifndef SMALLOC_COMPACT
+            struct _smalloc_chunk_t* chunks;
+#endif
+            _smalloc_size_t hiwater;
+        };
+        struct {
+            struct _smalloc_pagegroup_t* slabnext;
+            struct _smalloc_arena* volatile arena;
+            uint32_t slotsize;
+            uint32_t nslots;
+            uint32_t hint;
+            uint32_t slots;
+        };
+    };
+
+    _smalloc_size_t prefaulted;
 };
 
+#define _SMALLOC_PG_CHUNKS      (0)
+#define _SMALLOC_PG_SLAB        (1)
+#define _SMALLOC_PG_STACK       (2)
+#define _SMALLOC_PG_RING        (3)
+#define _SMALLOC_PG_POOL        (4)
+
 /*
 * This variable allows you to tune the smallest group of pages your
 * program can allocate.  If you know that you'll be working with large
@@ -63,275 +236,5624 @@ struct _smalloc_pagegroup_t {
 * will spend less time hunting for page groups to fulfill a request.
 */
 #ifndef SMALLOC_SMALLEST_PAGE_GROUP
-#define SMALLOC_SMALLEST_PAGE_GROUP     (8)
+  #ifdef SMALLOC_COMPACT
+  #define SMALLOC_SMALLEST_PAGE_GROUP   (2)
+  #else
+  #define SMALLOC_SMALLEST_PAGE_GROUP   (8)
+  #endif
 #endif
 
-static struct _smalloc_info {
-    int ready;
-    size_t pagesize;
-    struct _smalloc_pagegroup_t *pglist;
-#ifdef _WIN32
-    HANDLE heap_ptr;
+/*
+* Every chunk handed out is a multiple of this many bytes and starts on
+* a boundary of this many bytes, the same guarantee malloc(3) gives.  It
+* must be a power of two and at least sizeof(void*): a freed chunk queued
+* for the reclaimer stores its list link in its first word.
+* SMALLOC_COMPACT builds default to 8; define 16 there if the program
+* keeps long doubles or vector types in the heap.
+*/
+#ifndef SMALLOC_ALIGNMENT
+  #ifdef SMALLOC_COMPACT
+  #define SMALLOC_ALIGNMENT             (8)
+  #else
+  #define SMALLOC_ALIGNMENT             (16)
+  #endif
 #endif
-} _info = {0};
 
 /*
-* Private function prototypes for page group management.
+* Requests of up to SMALLOC_SLAB_MAX bytes are served from slabs of at
+* least SMALLOC_SLAB_PAGES pages each, one size class for every multiple
+* of SMALLOC_ALIGNMENT.  Bigger slabs mean fewer page groups to search
+* on sfree() but more memory held per size class in use.
 */
+#ifndef SMALLOC_SLAB_MAX
+#define SMALLOC_SLAB_MAX                (256)
+#endif
+
+#ifndef SMALLOC_SLAB_PAGES
+  #ifdef SMALLOC_COMPACT
+  #define SMALLOC_SLAB_PAGES            (2)
+  #else
+  #define SMALLOC_SLAB_PAGES            (16)
+  #endif
+#endif
 
 /*
-* _pages_alloc:
-* This function calls the underlying OS memory allocation routines to
-* reserve pages for the allocator.
-*
-* size - number of bytes that are required to allocate to the program.
-* pcount - number of pages to allocate to fulfill the request.  If a value
-*     of zero is provided, the function will make its best guess to fulfill
-*     the 'size' requirement.  Extra pages may be requested regardless if
-*     those pages will not be needed to meet the size required.  If pcount
-*     is less than the minimum amount of pages required to fulfill the size
-*     requirement, the minimum number of pages required to fulfill the
-*     request will be allocated.
-*
-* returns a page group that was allocated.
+* A slab's header and bitmap cost it about one slot, which is a lot of
+* a small slab of big slots: two pages of 256 byte slots lose one in 32.
+* Slabs of the bigger size classes are given as many more pages as it
+* takes to hold about SMALLOC_SLAB_SLOTS slots.
 */
-struct _smalloc_pagegroup_t* _pages_alloc(size_t size, size_t pcount);
+#ifndef SMALLOC_SLAB_SLOTS
+#define SMALLOC_SLAB_SLOTS              (64)
+#endif
+
+#define _SMALLOC_NSLABCLASSES   (SMALLOC_SLAB_MAX / SMALLOC_ALIGNMENT)
 
 /*
-* _pgroup_append:
-* This takes a group of pages, taken from _pages_alloc, and attaches
-* it to the end of the pagegroup list.  All the pagegroup metadata is
-* initialized before it is appended.
-*
-* list - list of pagegroups that have already been reserved by the
-*     allocator.  The head node for this list is found in '_info'.
-* block - block of memory to append to the end of the list.  The function
-*     calls for a void pointer, but the memory can be of type void* or
-*     of type pagegroup_t*.
-*
-* returns 0 on success, less than 0 on failure.
+* Stack allocators grow by page groups of at least this many pages.
 */
-int   _pgroup_append(struct _smalloc_pagegroup_t* list, void* block);
+#ifndef SMALLOC_STACK_PAGES
+  #ifdef SMALLOC_COMPACT
+  #define SMALLOC_STACK_PAGES           (2)
+  #else
+  #define SMALLOC_STACK_PAGES           (16)
+  #endif
+#endif
 
 /*
-* _pgroup_cleanup:
-* This function traverses the entire list and looks for page groups that
-* have no memory in use and releases them back to the OS.
-*
-* list - the pagegroup list to be pruned of free page groups.
-*
-* returns 0 on success, less than 0 on failure.
+* A frame buffer that hasn't needed all of its page groups for this many
+* of its frames gives the unneeded ones back.
 */
-int   _pgroup_cleanup(struct _smalloc_pagegroup_t* list);
+#ifndef SMALLOC_FRAME_QUIET
+#define SMALLOC_FRAME_QUIET             (64)
+#endif
 
-int   _pgroup_fits(struct _smalloc_pagegroup_t* pg, size_t size);
+/*
+* Coroutine frames of up to SMALLOC_CORO_MAX bytes are cached per thread
+* in size classes SMALLOC_CORO_CLASS bytes apart, at most
+* SMALLOC_CORO_CACHE of each.  Bigger frames go straight to the heap.
+*/
+#ifndef SMALLOC_CORO_MAX
+#define SMALLOC_CORO_MAX                (4096)
+#endif
 
-struct _smalloc_chunk_t*  _pgroup_reserve(struct _smalloc_pagegroup_t* pg,
-    size_t size);
+#ifndef SMALLOC_CORO_CLASS
+#define SMALLOC_CORO_CLASS              (64)
+#endif
 
-int _smalloc_init(void);
+#ifndef SMALLOC_CORO_CACHE
+#define SMALLOC_CORO_CACHE              (256)
+#endif
+
+#define _SMALLOC_NCOROCLASSES   (SMALLOC_CORO_MAX / SMALLOC_CORO_CLASS)
 
 /*
-* Public functions exposed in smalloc.h
+* Zeroing and copying more than this many bytes bypasses the cache with
+* non-temporal stores, since the data would only evict the caller's
+* working set.  Zero means use the size of the last level cache.
 */
-void *smalloc(size_t size)
-{
-    struct _smalloc_chunk_t* chk;
-    struct _smalloc_pagegroup_t* pg;
-
-    /*
-    * If the structure has been initialized (most likely case), we
-    * look through the existing list of pages and see if we have any
-    * groups that can support the size request.
-    */
-
-#ifdef SMALLOC_DEBUG
-    fprintf(stdout, "INFO: smalloc: Asking for %lu bytes.\n", size);
+#ifndef SMALLOC_NT_THRESHOLD
+#define SMALLOC_NT_THRESHOLD            (0)
 #endif
 
-    if (_info.ready) {
-        pg = _info.pglist;
-        while (pg && !_pgroup_fits(pg, size)) {
-            pg = pg->next;
-        }
-    } else {
-        if (_smalloc_init()) {
-#ifdef SMALLOC_DEBUG
-            fprintf(stderr, "ERROR: smalloc: Failed to initialization.\n");
+/*
+* Allocations of at least SMALLOC_POPULATE_THRESHOLD bytes are prefaulted
+* by smalloc_populate() with SMALLOC_POPULATE_THREADS threads before they
+* are returned, so the caller never takes their page faults one at a
+* time.  Zero turns this off; zero threads means one per online CPU.
+* With SMALLOC_POPULATE_INTERLEAVE set, smalloc_populate() also spreads
+* the pages over every NUMA node the process may allocate from.
+*/
+#ifndef SMALLOC_POPULATE_THRESHOLD
+#define SMALLOC_POPULATE_THRESHOLD      (0)
 #endif
-            return NULL;
-        }
-        pg = _pages_alloc(size, SMALLOC_SMALLEST_PAGE_GROUP);
-        if (!pg) {
-#ifdef SMALLOC_DEBUG
-            fprintf(stderr, "ERROR: failed to initialize smalloc\n");
+
+#ifndef SMALLOC_POPULATE_THREADS
+#define SMALLOC_POPULATE_THREADS        (0)
 #endif
-            return NULL;
 
-        }
-        _info.pglist = pg;
-    }
+#ifndef SMALLOC_POPULATE_INTERLEAVE
+#define SMALLOC_POPULATE_INTERLEAVE     (0)
+#endif
 
+/*
+* Number of pages past each page group's bump pointer that the background
+* thread keeps populated, so that carving chunks off the group never
+* takes a page fault inline.  Zero turns this off.  It can be changed at
+* run time with smalloc_set_prefault().
+*/
+#ifndef SMALLOC_PREFAULT_PAGES
+#define SMALLOC_PREFAULT_PAGES          (0)
+#endif
 
-#ifdef SMALLOC_DEBUG
-    /* Sanity check to ensure the allocator was initialized. */
-    assert(_info.ready);
+/*
+* Where page groups get their pages from by default; one of the
+* SMALLOC_BACKEND_* values in smalloc.h.  smalloc_set_backend() can pick
+* another one before the first allocation.
+*/
+#ifndef SMALLOC_BACKEND
+#define SMALLOC_BACKEND                 SMALLOC_BACKEND_MMAP
 #endif
 
-    /*
-    * If we weren't able to find a page group to support the
-    * memory request in the above while() loop, we must ask
-    * the OS for more pages with a call to _pages_alloc.
-    */
-    if (!pg) {
-#ifdef SMALLOC_DEBUG
-        fprintf(stdout, "INFO: smalloc: No page group was found "
-            "to support %lu bytes.\n", size);
+/*
+* Size of each region of address space the buddy backend reserves and
+* carves page groups out of.  It must be a power of two number of pages.
+* Page groups bigger than a region are mapped directly.
+*/
+#ifndef SMALLOC_REGION_SIZE
+#define SMALLOC_REGION_SIZE             ((size_t)1 << 30)
 #endif
-        pg = _pages_alloc(size, SMALLOC_SMALLEST_PAGE_GROUP);
-        if (!pg) {
-#ifdef SMALLOC_DEBUG
-            fprintf(stderr, "ERROR: smalloc: Failed to allocate %lu "
-                "bytes.\n", size);
+
+#define _BUDDY_MAX_ORDERS       (40)
+#define _BUDDY_FREE             (0x80)
+#define _BUDDY_USED             (0x40)
+#define _BUDDY_ORDER            (0x3f)
+#define _BUDDY_NIL              ((uint32_t)-1)
+
+/*
+* A region of reserved address space managed as a binary buddy system.
+* Every block is a power of two run of pages aligned to its own size
+* from the start of the region.  All bookkeeping lives outside the
+* region, in the same mapping as this structure, so free blocks are
+* never touched and stay purged.
+*
+* base - the first page of the region.
+* npages - the number of pages in the region.
+* maxorder - log2 of 'npages'.
+* nfree - the number of free pages in the region.
+* head - for every order, the first free block of that order.
+* next, prev - per page links of the free lists, valid for block heads.
+* state - per page, _BUDDY_FREE or _BUDDY_USED plus the block's order for
+*     the first page of each block, zero for every other page.
+* metalen - the length of the mapping holding this structure.
+* link - the next region.
+*/
+struct _buddy_region {
+    char* base;
+    size_t npages;
+    int maxorder;
+    size_t nfree;
+    uint32_t head[_BUDDY_MAX_ORDERS];
+    uint32_t* next;
+    uint32_t* prev;
+    unsigned char* state;
+    size_t metalen;
+    struct _buddy_region* link;
+};
+
+/*
+* The most regions a memfd-backed heap can have, and so its size limit
+* in units of SMALLOC_REGION_SIZE.
+*/
+#define _SMALLOC_MAX_MEMFDS     (64)
+
+/*
+* A region of a memfd-backed heap: the file holds the region's pages,
+* followed by its backend's bookkeeping, and both are mapped from it.
+*
+* base, len - where the region's pages are mapped.
+* meta, metalen - where the backend's bookkeeping is mapped; this is the
+*     _buddy_region or _span_region itself.
+* fd - the memfd.
+* private - set while a snapshot is being held: the mappings are then
+*     MAP_PRIVATE, so the file keeps the pages as they were when the
+*     snapshot was taken.
+*/
+struct _memfd_region {
+    char* base;
+    size_t len;
+    char* meta;
+    size_t metalen;
+    int fd;
+    int private;
+};
+
+/*
+* Free runs shorter than this many pages are kept on exact-length lists,
+* longer ones on a single list ordered by length.
+*/
+#define _SPAN_NLISTS            (128)
+#define _SPAN_FREE              (1)
+#define _SPAN_USED              (2)
+
+/*
+* A region of reserved address space managed as a page heap: free runs
+* of any number of pages ("spans") are found by size for best fit and by
+* address for coalescing with their neighbours.  Like the buddy regions,
+* all bookkeeping lives outside the region.
+*
+* base - the first page of the region.
+* npages - the number of pages in the region.
+* nfree - the number of free pages in the region.
+* head - the free lists.  Entry 'n' holds the free spans of exactly 'n'
+*     pages, in address order; entry 0 holds the longer ones ordered by
+*     length, then address.
+* nonempty - a bitmap of the non-empty entries of 'head'.
+* next, prev - per page links of the free lists, valid for span heads.
+* len, state - per page, the length of the span and whether it is free
+*     or used.  Only valid on a span's first and last page.
+* metalen - the length of the mapping holding this structure.
+* link - the next region.
+*/
+struct _span_region {
+    char* base;
+    size_t npages;
+    size_t nfree;
+    uint32_t head[_SPAN_NLISTS];
+    uint64_t nonempty[_SPAN_NLISTS / 64];
+    uint32_t* next;
+    uint32_t* prev;
+    uint32_t* len;
+    unsigned char* state;
+    size_t metalen;
+    struct _span_region* link;
+};
+
+#define _SMALLOC_ROUND(n) \
+    (((n) + (SMALLOC_ALIGNMENT - 1)) & ~((size_t)SMALLOC_ALIGNMENT - 1))
+
+/*
+* Page group headers and slab bitmaps are padded to whole cache lines, so
+* the memory after them doesn't share a line with them.  Compact builds
+* pad them only as far as slot alignment needs.
+*/
+#define _SMALLOC_CACHELINE      (64)
+#ifdef SMALLOC_COMPACT
+#define _SMALLOC_HDRALIGN       (32)
+#else
+#define _SMALLOC_HDRALIGN       _SMALLOC_CACHELINE
 #endif
-            return NULL;
-        }
+#define _SMALLOC_HDRROUND(n) \
+    (((n) + _SMALLOC_HDRALIGN - 1) & ~(size_t)(_SMALLOC_HDRALIGN - 1))
 
-        /*
-        * Once the page group has been successfully allocated,
-        * ensure the reference to the group isn't left dangling.
-        * Append it to the list of pages in the _info structure.
-        */
-        _pgroup_append(_info.pglist, pg);
-    }
+/* Header sizes, padded so that the memory following them stays aligned. */
+#define _SMALLOC_PGHDR_SIZE \
+    _SMALLOC_HDRROUND(sizeof(struct _smalloc_pagegroup_t))
+#define _SMALLOC_CHKHDR_SIZE    _SMALLOC_ROUND(sizeof(struct _smalloc_chunk_t))
 
+#define _SMALLOC_PGLEN(pg) \
+    ((size_t)(pg)->npages * _info.pagesize - _SMALLOC_PGHDR_SIZE)
+#define _SMALLOC_BITMAP(pg) \
+    ((uint64_t*)((char*)(pg) + _SMALLOC_PGHDR_SIZE))
+#define _SMALLOC_SLOTS(pg)      ((char*)(pg) + (pg)->slots)
 
-    if (pg == NULL) {
-#ifdef SMALLOC_DEBUG
-        fprintf(stderr, "ERROR: smalloc: Failed to find/allocate page "
-            "group.\n");
+/*
+* A mark/release stack allocator.  It lives at the start of its first
+* page group and bumps through a chain of _SMALLOC_PG_STACK groups, which
+* stay off the heap's page group list.  Groups past the current one are
+* left over from deeper scopes and are reused before any new ones are
+* mapped.
+*
+* first - the group this structure lives in, and the head of the chain.
+* cur - the group allocations are bumped from.
+* nmoves - how many times allocation has moved on to the next group,
+*     which the frame allocator uses to size its buffers.
+* heap - set once the stack has been some thread's heap, from when on
+*     its groups are in the page map so that sfree() and srealloc() can
+*     tell its objects apart from any thread.
+* nextheap - the next stack on '_info.heaps'.
+*/
+struct smalloc_stack {
+    struct _smalloc_pagegroup_t* first;
+    struct _smalloc_pagegroup_t* cur;
+    size_t nmoves;
+    int heap;
+    struct smalloc_stack* nextheap;
+};
+
+/*
+* Each thread's frame allocator: two stacks used for alternate frames.
+*
+* buf - the two buffers, created on the thread's first allocation.
+* start - the marks each buffer is rewound to when a frame starts in it.
+* cur - the buffer of the current frame.
+* peak - for each buffer, the most page groups one of its frames used
+*     since it was last trimmed.
+* quiet - for each buffer, how many of its frames ago it was trimmed.
+*/
+struct _smalloc_frame {
+    struct smalloc_stack* buf[2];
+    struct smalloc_stack_mark start[2];
+    unsigned cur;
+    size_t peak[2];
+    unsigned quiet[2];
+};
+
+static _SMALLOC_TLS struct _smalloc_frame _frame;
+
+/*
+* The stack allocator the calling thread's smalloc() and friends are
+* redirected to, or NULL for the heap.
+*/
+static _SMALLOC_TLS struct smalloc_stack* _heap;
+
+#define _SMALLOC_HEAPHDR_SIZE   _SMALLOC_ROUND(sizeof(size_t))
+
+/*
+* Small objects come from arenas: each has its own lock and its own
+* slabs, and every thread allocates from one of them, so threads don't
+* all queue on the heap lock for small objects.  These variables tune
+* how many arenas are in use.  Every SMALLOC_ARENA_INTERVAL small
+* allocations a thread looks at how many of the arena lock acquisitions
+* since the last look found the lock held, in thousandths.  Above
+* SMALLOC_ARENA_GROW the number of arenas doubles, up to
+* SMALLOC_MAX_ARENAS and the number of threads; at or below
+* SMALLOC_ARENA_SHRINK for SMALLOC_ARENA_QUIET looks in a row it halves
+* again.  Only the first SMALLOC_STATS_NARENAS arenas are broken out in
+* the statistics.
+*/
+#ifndef SMALLOC_MAX_ARENAS
+  #ifdef SMALLOC_COMPACT
+  #define SMALLOC_MAX_ARENAS            (1)
+  #else
+  #define SMALLOC_MAX_ARENAS            SMALLOC_STATS_NARENAS
+  #endif
 #endif
-        return NULL;
-    }
 
-    /*
-    * Ask for a chunk from the page group.  When we get the chunk, all
-    * the internal metadata will not be initialized.  Do that here.
-    */
-    chk = _pgroup_reserve(pg, size);
-    if (chk == NULL) {
-#ifdef SMALLOC_DEBUG
-        fprintf(stderr, "ERROR: smalloc: Failed to reserve chunk from "
-            "page group.\n");
+#ifndef SMALLOC_ARENA_INTERVAL
+#define SMALLOC_ARENA_INTERVAL          (4096)
 #endif
-        return NULL;
-    }
 
-    chk->ptr = chk + sizeof(struct _smalloc_chunk_t);
-    chk->len = size;
-    chk->freed = 0;
+#ifndef SMALLOC_ARENA_GROW
+#define SMALLOC_ARENA_GROW              (50)
+#endif
 
-    return chk->ptr;
-}
+#ifndef SMALLOC_ARENA_SHRINK
+#define SMALLOC_ARENA_SHRINK            (5)
+#endif
 
-int
-_smalloc_init(void)
-{
-    /* Determine the page size of the underlying OS */
-#ifdef _WIN32
-    SYSTEM_INFO si;
-    GetSystemInfo(&si);
-    _info.pagesize = si.dwPageSize;
-    _info.heap_ptr = GetProcessHeap();
-    if (_info.heap_ptr == NULL) {
-#ifdef SMALLOC_DEBUG
-        fprintf(stderr, "ERROR: _smalloc_init: Failed to get heap pointer "
-            "from GetProcessHeap() call.\n");
+#ifndef SMALLOC_ARENA_QUIET
+#define SMALLOC_ARENA_QUIET             (16)
 #endif
-        return -1;
-    }
-#else
-    _info.pagesize = sysconf(_SC_PAGESIZE);
+
+/*
+* Empty slabs go to a pool any size class in any arena can take them
+* from.  Once one has sat there for SMALLOC_DECAY_MS milliseconds its
+* pages, all but the first, are handed back to the OS.  It can be
+* changed at run time with smalloc_set_decay().
+*/
+#ifndef SMALLOC_DECAY_MS
+#define SMALLOC_DECAY_MS                (10000)
 #endif
-    _info.ready = 1;
 
-    return 0;
-}
+/*
+* The share of the statistics an arena keeps for the objects allocated
+* from and freed to its slabs, under the arena lock.  The fields are the
+* same as in struct smalloc_stats.
+*/
+struct _arena_stats {
+    size_t bytes_allocated;
+    size_t nchunks;
+    size_t nchunks_class[SMALLOC_STATS_NCLASSES];
+    size_t bytes_tagged[SMALLOC_STATS_NTAGS];
+    unsigned long long nallocs;
+    unsigned long long nfrees;
+};
 
-struct _smalloc_pagegroup_t*
+/*
+* The restore point of a memfd-backed heap, if one is held: everything
+* about the heap that doesn't live in its regions.
+*
+* active - set while a snapshot is held.
+* nmemfds - how many regions there were; later ones are dropped again on
+*     a rollback.
+* pglist, slablist, heaps, regions, spans, stats - copies of the same
+*     '_info' fields.
+* slabs, astats - copies of every arena's slab lists and statistics.
+* pool, npooled, ndirty - copies of the same '_pool' fields.
+*/
+#ifndef _WIN32
+static struct _smalloc_snapshot {
+    int active;
+    size_t nmemfds;
+    struct _smalloc_pagegroup_t* pglist;
+    struct _smalloc_pagegroup_t* slablist;
+    struct smalloc_stack* heaps;
+    struct _smalloc_pagegroup_t*
+        slabs[SMALLOC_MAX_ARENAS][_SMALLOC_NSLABCLASSES];
+    struct _buddy_region* regions;
+    struct _span_region* spans;
+    struct smalloc_stats stats;
+    struct _arena_stats astats[SMALLOC_MAX_ARENAS];
+    uintptr_t pool;
+    size_t npooled;
+    size_t ndirty;
+} _snap;
+#endif
+
+/*
+* The header in front of every coroutine frame.
+*
+* owner - the cache the frame goes back to, NULL for frames too big to
+*     be cached.
+* cls - the frame's size class.
+* next - links the frame into a free list or remote free stack.
+*/
+struct _coro_hdr {
+    struct _coro_cache* owner;
+    size_t cls;
+    struct _coro_hdr* next;
+};
+
+#define _SMALLOC_COROHDR_SIZE   _SMALLOC_ROUND(sizeof(struct _coro_hdr))
+
+/*
+* A thread's coroutine frame cache.  Caches are never unmapped: when a
+* thread exits, its cache is retired and handed to the next new thread,
+* so frames still out can always be returned to their owner.
+*
+* free, count - for each size class, the cached frames and how many
+*     there are.
+* remote - frames freed by other threads, pushed lock-free and taken
+*     all at once by the owner.  _CORO_RETIRED while nobody owns the
+*     cache, in which case frames are freed to the heap instead.
+* link - the next retired cache.
+* all - the next of every cache ever made, so that a forked child can
+*     retire the caches of threads that didn't survive the fork.
+*/
+struct _coro_cache {
+    struct _coro_hdr* free[_SMALLOC_NCOROCLASSES];
+    size_t count[_SMALLOC_NCOROCLASSES];
+    char pad[_SMALLOC_CACHELINE];
+    struct _coro_hdr* volatile remote;
+    struct _coro_cache* link;
+    struct _coro_cache* all;
+};
+
+#define _CORO_RETIRED           ((struct _coro_hdr*)1)
+
+static _SMALLOC_TLS struct _coro_cache* _coro;
+
+/*
+* The header in front of every message in a ring allocator.
+*
+* len - the bytes the message takes in the ring, header included.
+* freed - set once the message has been freed but the tail hasn't
+*     reached it yet, or from the start for the filler that pads out the
+*     end of the ring when a message doesn't fit there.
+*/
+struct _ring_hdr {
+    uint32_t len;
+    volatile uint32_t freed;
+};
+
+#define _SMALLOC_RINGHDR_SIZE   _SMALLOC_ROUND(sizeof(struct _ring_hdr))
+
+/*
+* A FIFO ring allocator.  It lives at the start of its page group and
+* hands out messages from the rest of it.  'head' and 'tail' count every
+* byte ever allocated and reclaimed; the ring holds the messages between
+* them, at offsets modulo 'cap'.  Only the allocating thread writes
+* 'head' and only the freeing thread writes 'tail', and they are kept on
+* separate cache lines.
+*
+* pg - the page group this structure lives in.
+* buf, cap - the message area.
+* head - where the next message goes.
+* tail - the oldest message not yet reclaimed.
+*/
+struct smalloc_ring {
+    struct _smalloc_pagegroup_t* pg;
+    char* buf;
+    size_t cap;
+    char pad0[_SMALLOC_CACHELINE - sizeof(void*) * 2 - sizeof(size_t)];
+    volatile size_t head;
+    char pad1[_SMALLOC_CACHELINE - sizeof(size_t)];
+    volatile size_t tail;
+    char pad2[_SMALLOC_CACHELINE - sizeof(size_t)];
+};
+
+/*
+* This variable controls how long a thread spins on a held lock before
+* it goes to sleep in the kernel.  The allocator's critical sections are
+* short, so most waits end while spinning; sleeping only pays off when
+* the lock holder has been preempted.
+*/
+#ifndef SMALLOC_LOCK_SPINS
+#define SMALLOC_LOCK_SPINS              (128)
+#endif
+
+/*
+* An adaptive lock: a waiter spins briefly and then sleeps on a futex.
+*
+* state - 0 when unlocked, 1 when locked, 2 when locked and at least one
+*     thread may be sleeping on it.
+* stats - contention counters reported through smalloc_stats().  They are
+*     only ever written by the thread holding the lock.
+*/
+struct _smalloc_lock_t {
+    volatile int state;
+    struct smalloc_lock_stats stats;
+};
+
+/*
+* An arena.  Its lock protects its slab lists and the bitmaps and live
+* counts of the slabs on them.  The heap lock is only needed to add a
+* slab, and is always taken before an arena lock.
+*
+* slabs - for each slab size class, the arena's slabs of that class.
+* nthreads - how many threads are mapped to the arena.
+* seq, stats - the arena's statistics, published through a sequence
+*     lock like '_info.stats'.
+*/
+struct _smalloc_arena {
+    struct _smalloc_lock_t lock;
+    struct _smalloc_pagegroup_t* slabs[_SMALLOC_NSLABCLASSES];
+    volatile size_t nthreads;
+    volatile unsigned seq;
+    struct _arena_stats stats;
+    char pad[_SMALLOC_CACHELINE];
+};
+
+/*
+* The arenas and the state of their sizing.
+*
+* narenas - the arenas threads are mapped to are the first 'narenas'.
+*     Arenas past them have had their slabs moved to the others.
+* epoch - bumped whenever 'narenas' changes, telling threads to pick an
+*     arena again.
+* fixed - set while smalloc_set_arenas() holds the count fixed.
+* adapting - taken by the one thread sizing the arenas at a time.
+* quiet - how many looks in a row have found contention low.
+* acquisitions, contended - the arena lock counters at the last look.
+*/
+static struct _smalloc_arenas {
+    volatile unsigned narenas;
+    volatile unsigned epoch;
+    volatile int fixed;
+    volatile int adapting;
+    unsigned quiet;
+    unsigned long long acquisitions;
+    unsigned long long contended;
+    struct _smalloc_arena arena[SMALLOC_MAX_ARENAS];
+} _arenas = {1};
+
+/*
+* The arena the calling thread allocates small objects from, the epoch
+* it was picked in, and the small allocations since the arenas were last
+* sized.
+*/
+static _SMALLOC_TLS struct _arena_self {
+    struct _smalloc_arena* arena;
+    unsigned epoch;
+    unsigned ops;
+} _self;
+
+/*
+* The pool of empty slabs.  Groups are pushed and popped lock-free, but
+* only by a thread holding the heap lock or an arena lock, so snapshots
+* and fork(2), which take them all, find the pool at rest.  Slabs are
+* never unmapped, only purged, so a pop that loses a race can still read
+* the group it saw.
+*
+* head - the first group, linked through 'slabnext'.  The low bits count
+*     pushes and pops, so a pop doesn't take the same group coming back
+*     for the pool being unchanged.
+* npages, ndirty - the pages in the pool, and those not purged yet.
+* decay_ms - how long a group stays in the pool before it is purged.
+* next - when _pool_decay() is next due, in milliseconds.
+*/
+#ifdef _WIN32
+#define _SMALLOC_POOL_TAG       ((uintptr_t)7)
+#else
+#define _SMALLOC_POOL_TAG       ((uintptr_t)4095)
+#endif
+
+static struct _smalloc_pool {
+    volatile uintptr_t head;
+    volatile size_t npages;
+    volatile size_t ndirty;
+    unsigned decay_ms;
+    volatile unsigned long long next;
+} _pool = {0, 0, 0, SMALLOC_DECAY_MS};
+
+#ifdef SMALLOC_SINGLE_THREADED
+#define _pool_cas(old, new)     (_pool.head = (new), 1)
+#define _pool_add(var, n)       ((var) += (n))
+#else
+#define _pool_cas(old, new) \
+    __atomic_compare_exchange_n(&_pool.head, &(old), (new), 0, \
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define _pool_add(var, n) \
+    ((void)__atomic_add_fetch(&(var), (n), __ATOMIC_RELAXED))
+#endif
+
+/*
+* Slab page groups are found from an address through a two level radix
+* tree of _SMALLOC_PAGEMAP_SHIFT sized pages, so that sfree() can get to
+* a slab without taking the heap lock.  Entries are written under the
+* heap lock, or under an arena lock for a slab going into or coming out
+* of the pool, whose leaves always exist already.  Leaves are never
+* unmapped.  Addresses the tree can't
+* cover are simply freed under the heap lock instead.
+*/
+#define _SMALLOC_PAGEMAP_SHIFT  (12)
+#define _SMALLOC_PAGEMAP_BITS   (18)
+#define _SMALLOC_PAGEMAP_LEN    ((size_t)1 << _SMALLOC_PAGEMAP_BITS)
+
+/*
+* Finds the first non-zero word at or after 'start' in a bitmap of
+* 'nwords' words, returning 'nwords' if there is none.  There is one
+* version per instruction set; _info.scan points at the one in use.
+*/
+typedef size_t (*_bitmap_scan_t)(const uint64_t* map, size_t nwords,
+    size_t start);
+
+/*
+* Global allocator state.
+*
+* pglist - the page groups new chunks are carved from.
+* slablist - every slab, in or out of the pool, newest first.  Slabs are
+*     kept off 'pglist' so that chunk lookups don't walk past them; the
+*     slab an object lives in is found through the page map instead.
+* heaps - every stack that has been a thread's heap, linked by
+*     'nextheap'.
+* inherited - page groups a forked child inherited from its parent under
+*     the SMALLOC_FORK_FRESH policy.  The child never allocates from them
+*     and ignores frees into them, so their pages stay shared with the
+*     parent instead of being copied on the child's first write.
+* fork_policy - what a forked child does with the parent's page groups.
+* simd, scan - the SMALLOC_SIMD_* level in use and its bitmap scanner.
+* nt_threshold - size above which smalloc_memzero and smalloc_memcpy
+*     use non-temporal stores.
+* prefault_pages - the prefault-ahead window, in pages.
+* backend - the SMALLOC_BACKEND_* page groups get their pages from.
+* regions - the buddy backend's regions.
+* spans - the span backend's regions.
+* memfd - set if the backend's regions are backed by memfds.
+* memfds, nmemfds - those regions, in order of creation.
+* pagemap - the root of the slab page map, mapped on first use.
+*/
+static struct _smalloc_info {
+    int ready;
+    size_t pagesize;
+    struct _smalloc_pagegroup_t *pglist;
+    struct _smalloc_pagegroup_t *slablist;
+    struct smalloc_stack *heaps;
+    struct _smalloc_pagegroup_t *inherited;
+    int fork_policy;
+    int simd;
+    _bitmap_scan_t scan;
+    size_t nt_threshold;
+    size_t prefault_pages;
+    int backend;
+    struct _buddy_region* regions;
+    struct _span_region* spans;
+    int memfd;
+    struct _memfd_region memfds[_SMALLOC_MAX_MEMFDS];
+    size_t nmemfds;
+    struct _smalloc_pagegroup_t** volatile* volatile pagemap;
+    struct _smalloc_lock_t lock;
+    volatile unsigned stats_seq;
+    struct smalloc_stats stats;
+#ifdef _WIN32
+    HANDLE heap_ptr;
+#endif
+} _info = {0};
+
+/*
+* '_info.stats' is published through a sequence lock so that monitoring
+* threads can read it without ever touching the heap lock.  Writers
+* already hold the heap lock and only bracket their updates with
+* _stats_begin() and _stats_end(), which make 'stats_seq' odd while the
+* counters are in flux.  Readers retry until they copy the counters
+* between two identical, even values of 'stats_seq'.
+*/
+#ifdef SMALLOC_SINGLE_THREADED
+#define _seq_begin(seq)         ((void)0)
+#define _seq_end(seq)           ((void)0)
+#else
+#define _seq_begin(seq) do { \
+    (seq)++; \
+    _atomic_fence(__ATOMIC_RELEASE); \
+} while (0)
+
+#define _seq_end(seq) do { \
+    _atomic_store(&(seq), (seq) + 1, __ATOMIC_RELEASE); \
+} while (0)
+#endif
+
+#define _stats_begin()          _seq_begin(_info.stats_seq)
+#define _stats_end()            _seq_end(_info.stats_seq)
+
+#ifndef SMALLOC_COMPACT
+/*
+* Maps a chunk size onto one of the SMALLOC_STATS_NCLASSES size classes
+* the statistics break live chunks down into.  Class 0 holds chunks of
+* up to 16 bytes and each following class holds chunks up to twice the
+* size of the one before; the last class catches everything bigger.
+*/
+static int
+_stats_class(size_t size)
+{
+    size_t limit = 16;
+    int c = 0;
+
+    while (size > limit && c < SMALLOC_STATS_NCLASSES - 1) {
+        limit <<= 1;
+        c++;
+    }
+
+    return c;
+}
+#endif
+
+/*
+* Accounts for 'n' objects of 'size' bytes allocated from or freed back
+* to 'pg'.  The caller must hold the heap lock.
+*/
+static void
+_stats_alloc(struct _smalloc_pagegroup_t* pg, size_t size, size_t n)
+{
+#ifndef SMALLOC_COMPACT
+    _stats_begin();
+    _info.stats.bytes_allocated += size * n;
+    _info.stats.nchunks += n;
+    _info.stats.nchunks_class[_stats_class(size)] += n;
+    _info.stats.bytes_tagged[pg->tag] += size * n;
+    _info.stats.nallocs += n;
+    _stats_end();
+#endif
+}
+
+static void
+_stats_free(struct _smalloc_pagegroup_t* pg, size_t size)
+{
+#ifndef SMALLOC_COMPACT
+    _stats_begin();
+    _info.stats.bytes_allocated -= size;
+    _info.stats.nchunks--;
+    _info.stats.nchunks_class[_stats_class(size)]--;
+    _info.stats.bytes_tagged[pg->tag] -= size;
+    _info.stats.nfrees++;
+    _stats_end();
+#endif
+}
+
+/*
+* The same for objects in slabs, which are accounted to the slab's
+* arena.  The caller must hold the arena lock.
+*/
+static void
+_arena_stats_alloc(struct _smalloc_pagegroup_t* pg, size_t size, size_t n)
+{
+#ifndef SMALLOC_COMPACT
+    struct _smalloc_arena* a = pg->arena;
+
+    _seq_begin(a->seq);
+    a->stats.bytes_allocated += size * n;
+    a->stats.nchunks += n;
+    a->stats.nchunks_class[_stats_class(size)] += n;
+    a->stats.bytes_tagged[pg->tag] += size * n;
+    a->stats.nallocs += n;
+    _seq_end(a->seq);
+#endif
+}
+
+static void
+_arena_stats_free(struct _smalloc_pagegroup_t* pg, size_t size)
+{
+#ifndef SMALLOC_COMPACT
+    struct _smalloc_arena* a = pg->arena;
+
+    _seq_begin(a->seq);
+    a->stats.bytes_allocated -= size;
+    a->stats.nchunks--;
+    a->stats.nchunks_class[_stats_class(size)]--;
+    a->stats.bytes_tagged[pg->tag] -= size;
+    a->stats.nfrees++;
+    _seq_end(a->seq);
+#endif
+}
+
+/*
+* Most page groups the reclaimer tops up the prefault window of per pass.
+*/
+#define _SMALLOC_PREFAULT_RANGES        (32)
+
+/*
+* State of the background reclaimer used by sfree_async().
+*
+* head - lock-free stack of chunks waiting to be freed.  The stack is
+*     linked through the first word of each chunk's user memory, which
+*     the caller has given up by the time it is queued.
+* pending - number of chunks pushed but not yet freed.  sfree_async_flush
+*     waits on this to reach zero.
+* started - set once the reclaimer thread has been created.
+* tick - if non-zero, the reclaimer also wakes up every 'tick'
+*     milliseconds to do periodic work, such as publishing statistics
+*     to shared memory.
+* prefault - set when some page group's prefault-ahead window has run
+*     low and the reclaimer should top it up.
+* pinned, npinned - the page groups the reclaimer is populating outside
+*     the heap lock.  _pgroup_cleanup leaves them alone until they are
+*     unpinned, so the pages can't be purged or reused underneath it.
+*     Only read or written under the heap lock.
+* lock, wake - used only to put the reclaimer to sleep while 'head' is
+*     empty; producers never touch them unless the stack was empty.
+*/
+#ifdef _SMALLOC_THREADS
+static struct _smalloc_reclaimer {
+    void* volatile head;
+    volatile size_t pending;
+    volatile int started;
+    volatile unsigned tick;
+    volatile int prefault;
+    struct _smalloc_pagegroup_t* pinned[_SMALLOC_PREFAULT_RANGES];
+    int npinned;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} _reclaim = {NULL, 0, 0, 0, 0, {NULL}, 0, 0, PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER};
+
+/*
+* The shared memory segment statistics are exported to, if any.
+*
+* seg - the mapped segment, NULL while nothing is being exported.
+* name - the name the segment was created under with shm_open(3).
+*/
+static struct _smalloc_shm {
+    struct smalloc_shm_segment* volatile seg;
+    char name[64];
+} _shm = {NULL, {0}};
+#endif
+
+/*
+* Private function prototypes for page group management.
+*/
+
+/*
+* _pages_alloc:
+* This function calls the underlying OS memory allocation routines to
+* reserve pages for the allocator.
+*
+* size - number of bytes that are required to allocate to the program.
+* pcount - number of pages to allocate to fulfill the request.  If a value
+*     of zero is provided, the function will make its best guess to fulfill
+*     the 'size' requirement.  Extra pages may be requested regardless if
+*     those pages will not be needed to meet the size required.  If pcount
+*     is less than the minimum amount of pages required to fulfill the size
+*     requirement, the minimum number of pages required to fulfill the
+*     request will be allocated.
+*
+* returns a page group that was allocated.
+*/
+struct _smalloc_pagegroup_t* _pages_alloc(size_t size, size_t pcount);
+
+/*
+* _pages_release:
+* Hands a page group obtained from _pages_alloc back to the OS.  The
+* group must already be unlinked from the page group list.
+*/
+void  _pages_release(struct _smalloc_pagegroup_t* pg);
+
+/*
+* _extent_alloc, _extent_free:
+* Get a run of pages from the selected backend and give it back.  The
+* backend may round '*npages' up; it is updated to the number of pages
+* actually handed out.  Returned pages are always zero filled.
+*/
+void* _extent_alloc(size_t* npages);
+void  _extent_free(void* ptr, size_t npages);
+
+/*
+* _extent_grow:
+* Grows the extent at 'ptr' from 'npages' to at least '*newpages' pages,
+* updating '*newpages' to its new length.  Returns 'ptr' if the pages
+* right after the extent could be taken, or if 'maymove' is set and the
+* extent could be remapped whole, its new address.  Returns NULL, with
+* the extent untouched, otherwise.
+*/
+void* _extent_grow(void* ptr, size_t npages, size_t* newpages, int maymove);
+
+/*
+* _region_map:
+* Reserves 'len' bytes of address space for a region, plus '*metalen'
+* bytes, rounded up to whole pages, for its bookkeeping at '*meta'.  In
+* a memfd-backed heap both are mapped from a new memfd.  Returns the
+* region's base, or NULL on failure.
+*/
+char* _region_map(size_t len, size_t* metalen, char** meta);
+
+/*
+* _region_purge:
+* Gives the pages of a free extent back to the OS, leaving the extent
+* zero filled.
+*/
+void  _region_purge(void* ptr, size_t len);
+
+/*
+* _memfd_rewrite:
+* Copies the pages of a memfd-backed region that are in use, and its
+* bookkeeping, to a new memfd and maps that in MAP_SHARED in place of
+* the old one.
+*
+* returns 0 on success, less than 0 on failure.
+*/
+int   _memfd_rewrite(struct _memfd_region* m);
+
+/*
+* _memfd_remap:
+* Maps a memfd-backed region's pages and bookkeeping from its memfd
+* again, with MAP_PRIVATE if 'private' is set, discarding any private
+* copies of its pages.
+*
+* returns 0 on success, less than 0 on failure.
+*/
+int   _memfd_remap(struct _memfd_region* m, int private);
+
+/*
+* _buddy_alloc, _buddy_free:
+* The buddy backend.  _buddy_alloc rounds '*npages' up to a power of two
+* and returns NULL if that is bigger than a region.  _buddy_free returns
+* 0 if it took the extent back, less than 0 if the extent isn't in any
+* region.
+*/
+void* _buddy_alloc(size_t* npages);
+int   _buddy_free(void* ptr);
+
+/*
+* _buddy_stats:
+* Recomputes the backend's share of the statistics.  The caller must be
+* inside a _stats_begin()/_stats_end() pair.
+*/
+void  _buddy_stats(void);
+
+/*
+* _buddy_grow, _span_grow:
+* Grow an extent in place from the free space right after it, as with
+* _extent_grow.  Return 0 on success, less than 0 if there isn't enough
+* free space there, or if the extent isn't in any region.
+*/
+int   _buddy_grow(void* ptr, size_t* newpages);
+int   _span_grow(void* ptr, size_t* newpages);
+
+/*
+* _span_alloc, _span_free, _span_stats:
+* The span backend, as above.  _span_alloc returns exactly '*npages'
+* pages, taken from the best fitting free span with the lowest address.
+*/
+void* _span_alloc(size_t* npages);
+int   _span_free(void* ptr);
+void  _span_stats(void);
+
+/*
+* _pgroup_append:
+* This takes a group of pages, taken from _pages_alloc, and attaches
+* it to the end of the pagegroup list.  All the pagegroup metadata is
+* initialized before it is appended.
+*
+* list - the head of a list of pagegroups that have already been
+*     reserved by the allocator, such as '&_info.pglist'.  The list may
+*     be empty.
+* block - block of memory to append to the end of the list.  The function
+*     calls for a void pointer, but the memory can be of type void* or
+*     of type pagegroup_t*.
+*
+* returns 0 on success, less than 0 on failure.
+*/
+int   _pgroup_append(struct _smalloc_pagegroup_t** list, void* block);
+
+/*
+* _pgroup_cleanup:
+* This function traverses the entire list and looks for page groups that
+* have no memory in use and releases them back to the OS.  The head of
+* the list is always kept so that a program cycling through a handful of
+* allocations doesn't map and unmap pages on every call.  Groups the
+* reclaimer is prefaulting are left alone; it cleans up after itself.
+* Slabs are never on the list, and empty ones go to the pool instead.
+*
+* list - the pagegroup list to be pruned of free page groups.
+*
+* returns the number of page groups released, less than 0 on failure.
+*/
+int   _pgroup_cleanup(struct _smalloc_pagegroup_t* list);
+
+int   _pgroup_fits(struct _smalloc_pagegroup_t* pg, size_t size);
+
+/*
+* _pgroup_find:
+* Returns the page group on 'list' whose pages contain 'ptr', or NULL if
+* 'ptr' was not handed out from any group on that list.
+*/
+struct _smalloc_pagegroup_t* _pgroup_find(struct _smalloc_pagegroup_t* list,
+    void* ptr);
+
+/*
+* _pgroup_owner:
+* Returns the chunk group, slab or thread heap group that 'ptr' was handed
+* out from, or NULL if it was handed out from none of them.  Live slabs
+* and heaps are found through the page map; only chunks, pooled slabs and
+* bad pointers walk the lists.
+* The caller must hold the heap lock.
+*/
+struct _smalloc_pagegroup_t* _pgroup_owner(void* ptr);
+
+struct _smalloc_chunk_t*  _pgroup_reserve(struct _smalloc_pagegroup_t* pg,
+    size_t size);
+
+int _smalloc_init(void);
+
+/*
+* _chunk_alloc_locked:
+* Carves a chunk of 'size' bytes off the first page group of the right
+* tag with enough room, asking the OS for a new group if none has.
+*
+* fresh - if not NULL, set to 1 when the chunk has never been handed out
+*     before and is still zeroed, 0 otherwise.
+*/
+void* _chunk_alloc_locked(size_t size, unsigned tag, int* fresh);
+
+/*
+* _smalloc_tagged:
+* smalloc_tagged() without the redirection to the thread's heap, for
+* memory the allocator itself keeps beyond any one request.
+*/
+void* _smalloc_tagged(size_t size, unsigned tag);
+
+/*
+* _heap_alloc:
+* Allocates from a stack allocator standing in as a thread's heap (see
+* smalloc_thread_set_heap).  The size is kept in front of the object so
+* that srealloc() works on it.
+*/
+void* _heap_alloc(struct smalloc_stack* st, size_t size);
+
+/*
+* _heap_usable:
+* Returns the size of an object _heap_alloc() got from any stack that has
+* been a thread's heap, or 0 if 'ptr' isn't in one.  It takes no locks
+* where the page map is available.
+*/
+size_t _heap_usable(void* ptr);
+
+/*
+* _chunk_grow_locked:
+* Grows the chunk at 'ptr' to 'size' bytes without copying it, which is
+* possible when it is the last chunk in its page group: the group's free
+* space is used first, then the pages after the group.  A group whose
+* only live chunk is 'ptr' may be moved with mremap(2) instead.  Returns
+* the chunk's address, or NULL if it has to be copied.
+*/
+void* _chunk_grow_locked(void* ptr, size_t size);
+
+/*
+* _stack_next:
+* Moves a stack allocator on to the next group of its chain that can fit
+* 'size' bytes, mapping a new one if there isn't one, and allocates from
+* it.  Returns NULL when out of memory.
+*/
+void* _stack_next(struct smalloc_stack* st, size_t size);
+
+/*
+* _stack_trim:
+* Releases every group of a stack allocator's chain past the first
+* 'keep' ones.  The stack must be rewound to before those groups.
+*/
+void  _stack_trim(struct smalloc_stack* st, size_t keep);
+
+/*
+* _frame_init:
+* Creates the calling thread's frame buffers.
+*
+* returns 0 on success, less than 0 when out of memory.
+*/
+int   _frame_init(void);
+
+/*
+* _coro_init:
+* Gives the calling thread a coroutine frame cache, a retired one if
+* there is one.  Returns NULL when out of memory.
+*/
+struct _coro_cache* _coro_init(void);
+
+/*
+* _coro_drain:
+* Moves the frames other threads have freed to a cache onto its free
+* lists.
+*/
+void  _coro_drain(struct _coro_cache* c);
+
+#ifdef _SMALLOC_THREADS
+/*
+* _coro_retire:
+* Frees every frame cached in 'c' and puts it on the retired list for
+* the next new thread.  Frames still out are freed to the heap from then
+* on.  Called when the owning thread exits, or in a forked child for the
+* threads that weren't copied.
+*/
+void  _coro_retire(struct _coro_cache* c);
+#endif
+
+/*
+* _smalloc_usable_locked:
+* Returns the number of bytes usable at 'ptr', or 0 if 'ptr' wasn't
+* handed out by this allocator.  The caller must hold the heap lock.
+*/
+size_t _smalloc_usable_locked(void* ptr);
+
+/*
+* _slab_find:
+* Returns one of arena 'a's slabs of slot size 'size' and tag 'tag' with
+* at least one free slot, or NULL if they are all full.  The caller must
+* hold the arena lock.
+*/
+struct _smalloc_pagegroup_t* _slab_find(struct _smalloc_arena* a,
+    size_t size, unsigned tag);
+
+/*
+* _slab_new:
+* Creates a slab of slot size 'size' and tag 'tag' for arena 'a' and
+* links it into the arena.  The caller must hold the heap lock and the
+* arena lock.
+*/
+struct _smalloc_pagegroup_t* _slab_new(struct _smalloc_arena* a,
+    size_t size, unsigned tag);
+
+/*
+* _slab_init:
+* Makes the empty group 'pg' a slab of slot size 'size' and tag 'tag' and
+* links it into arena 'a' and the page map.  The caller must hold the
+* arena lock.
+*/
+void  _slab_init(struct _smalloc_arena* a, struct _smalloc_pagegroup_t* pg,
+    size_t size, unsigned tag);
+
+/*
+* _slab_retire:
+* Moves the empty slab at '*link', in one of its arena's slab lists, to
+* the pool.  The caller must hold the arena lock.
+*/
+void  _slab_retire(struct _smalloc_pagegroup_t** link);
+
+/*
+* _slab_lock:
+* Takes the lock of the arena slab 'pg' belongs to and returns the
+* arena.  The slab may move to another arena until the lock is held.
+*/
+struct _smalloc_arena* _slab_lock(struct _smalloc_pagegroup_t* pg);
+
+/*
+* _slab_take:
+* Takes up to 'count' free slots from 'pg', which must have at least
+* one, and stores their addresses in 'out'.  Whole bitmap words are
+* claimed at once when the request is big enough to use all of them.
+*
+* returns the number of slots taken.
+*/
+size_t _slab_take(struct _smalloc_pagegroup_t* pg, void** out, size_t count);
+
+/*
+* _slab_give:
+* Returns the slot at 'ptr' to slab 'pg', and retires the slab if that
+* left it empty and its class has others.
+*
+* returns 1 if the slab was retired, 0 otherwise.
+*/
+int   _slab_give(struct _smalloc_pagegroup_t* pg, void* ptr);
+
+/*
+* _pool_put:
+* Pushes the empty groups 'first' through 'last', linked through
+* 'slabnext', onto the pool.
+*/
+void  _pool_put(struct _smalloc_pagegroup_t* first,
+    struct _smalloc_pagegroup_t* last);
+
+/*
+* _pool_get:
+* Pops a group off the pool, or returns NULL if it is empty.
+*/
+struct _smalloc_pagegroup_t* _pool_get(void);
+
+/*
+* _pool_now:
+* Returns a monotonic clock in milliseconds.
+*/
+unsigned long long _pool_now(void);
+
+/*
+* _pool_decay:
+* Retires every arena's empty slabs, and purges the groups that have
+* been in the pool for '_pool.decay_ms' or longer.  The caller must hold
+* the heap lock.
+*/
+void  _pool_decay(unsigned long long now);
+
+/*
+* _pool_tick:
+* Runs _pool_decay() if it is due.  The caller must hold no lock.
+*/
+void  _pool_tick(void);
+
+/*
+* _arena_get:
+* Returns the calling thread's arena, mapping the thread to the arena
+* with the fewest threads when it has none yet or the arenas changed.
+*/
+struct _smalloc_arena* _arena_get(void);
+
+/*
+* _arena_take:
+* Allocates up to 'count' objects of 'size' bytes, already rounded to
+* SMALLOC_ALIGNMENT and at most SMALLOC_SLAB_MAX, under 'tag' from the
+* calling thread's arena, and stores them in 'out'.  The caller must not
+* hold the heap lock.
+*
+* returns the number of objects allocated.
+*/
+size_t _arena_take(size_t size, unsigned tag, void** out, size_t count);
+
+/*
+* _arena_adapt:
+* Looks at the arena lock contention since the last look and grows or
+* shrinks the number of arenas as needed.  Only one thread does so at a
+* time; others return at once.
+*/
+void  _arena_adapt(void);
+
+/*
+* _arena_resize:
+* Makes 'n' arenas available to threads.  The slabs of arenas dropped
+* are moved to the ones that remain.  The caller must not hold the heap
+* lock.
+*/
+void  _arena_resize(unsigned n);
+
+/*
+* _arena_merge:
+* Moves every slab of arena 'from' to arena 'to'.  The caller must hold
+* both arena locks.
+*/
+void  _arena_merge(struct _smalloc_arena* from, struct _smalloc_arena* to);
+
+/*
+* _pagemap_set:
+* Points the page map entries of every page in 'pg' at 'val', which is
+* either 'pg' or NULL.  The caller must hold the heap lock.
+*/
+void  _pagemap_set(struct _smalloc_pagegroup_t* pg,
+    struct _smalloc_pagegroup_t* val);
+
+/*
+* _pagemap_get:
+* Returns the slab or thread heap group 'ptr' is in, or NULL if it isn't
+* in a group known to the page map.  It takes no locks.
+*/
+struct _smalloc_pagegroup_t* _pagemap_get(void* ptr);
+
+/*
+* _pagemap_slabs:
+* Adds every slab in the page group list 'list' to the page map if 'set'
+* is non-zero, or removes them.  The caller must hold the heap lock.
+*/
+void  _pagemap_slabs(struct _smalloc_pagegroup_t* list, int set);
+
+/*
+* _pagemap_heaps:
+* Adds the page groups of every stack on '_info.heaps' to the page map if
+* 'set' is non-zero, or removes them.  The caller must hold the heap lock.
+*/
+void  _pagemap_heaps(int set);
+
+#ifndef _WIN32
+/*
+* Most threads smalloc_populate() will spread a range over.
+*/
+#define _SMALLOC_POPULATE_MAX_THREADS   (64)
+
+/*
+* One thread's share of the range smalloc_populate() is prefaulting.
+*/
+struct _populate_slice {
+    char* start;
+    char* end;
+    size_t pagesize;
+    int err;
+};
+
+/*
+* _populate_main:
+* Prefaults the pages of one slice, with MADV_POPULATE_WRITE where the
+* kernel has it and by touching every page where it doesn't.  Any other
+* failure, such as part of the slice being unmapped or inaccessible, is
+* left in the slice's 'err' as an errno value.
+*/
+void* _populate_main(void* arg);
+
+/*
+* _populate_interleave:
+* Sets an interleaved NUMA policy on the range so its pages are spread
+* evenly over all allowed nodes as they are faulted in.
+*/
+void  _populate_interleave(void* start, size_t len);
+#endif
+
+/*
+* _smalloc_nt_zero, _smalloc_nt_copy:
+* Zero or copy 'len' bytes with non-temporal stores of the widest
+* vector width selected by _smalloc_set_simd_locked.  Without vector
+* support they fall back to memset(3) and memcpy(3).
+*/
+void  _smalloc_nt_zero(void* dst, size_t len);
+void  _smalloc_nt_copy(void* dst, const void* src, size_t len);
+
+/*
+* _smalloc_set_simd_locked:
+* Selects the bitmap scanner for 'level', clamped to what the CPU
+* supports, and returns the level actually selected.
+*/
+int   _smalloc_set_simd_locked(int level);
+
+#ifndef _WIN32
+/*
+* _fork_prepare, _fork_parent, _fork_child:
+* pthread_atfork(3) handlers.  The heap lock is held across fork(2) so
+* the child never inherits a heap that is half way through an update.
+* The child then rebuilds everything that belonged to threads that did
+* not survive the fork: the heap lock, the reclaimer and its queue, and
+* the shared memory export, which stays with the parent.
+*/
+void _fork_prepare(void);
+void _fork_parent(void);
+void _fork_child(void);
+#endif
+
+/*
+* _lock_acquire, _lock_release:
+* Take and drop one of the allocator's adaptive locks.  Contended
+* acquisitions spin SMALLOC_LOCK_SPINS times before sleeping and are
+* counted, along with the time spent waiting, in the lock's stats.
+*/
+#ifdef SMALLOC_SINGLE_THREADED
+#define _lock_acquire(lk)       ((void)(lk))
+#define _lock_release(lk)       ((void)(lk))
+#else
+void _lock_acquire(struct _smalloc_lock_t* lk);
+void _lock_release(struct _smalloc_lock_t* lk);
+#endif
+
+/*
+* _smalloc_lock, _smalloc_unlock:
+* Take and drop the heap lock that protects '_info'.
+*/
+#ifdef SMALLOC_SINGLE_THREADED
+#define _smalloc_lock()         ((void)0)
+#define _smalloc_unlock()       ((void)0)
+#else
+void _smalloc_lock(void);
+void _smalloc_unlock(void);
+#endif
+
+/*
+* _smalloc_free_locked:
+* Releases a single chunk.  The caller must hold the heap lock.
+*
+* returns 1 if the chunk emptied an oversized page group that the caller
+* should hand to _pgroup_cleanup, 0 otherwise.
+*/
+int  _smalloc_free_locked(void* ptr);
+
+#ifdef _SMALLOC_THREADS
+/*
+* _reclaim_push:
+* Pushes an already linked chain of chunks, 'first' through 'last', onto
+* the reclaimer's stack and wakes the reclaimer if the stack was empty.
+*/
+void  _reclaim_push(void* first, void* last, size_t count);
+
+/*
+* _reclaim_batch:
+* Frees every chunk on the chain starting at 'list' while holding the
+* heap lock once for the whole batch.
+*/
+void  _reclaim_batch(void* list);
+
+void* _reclaim_main(void* arg);
+
+/*
+* _reclaim_start:
+* Starts the reclaimer thread if it isn't running yet.
+*
+* returns 0 on success, less than 0 if the thread could not be created.
+*/
+int   _reclaim_start(void);
+
+/*
+* _reclaim_wake:
+* Wakes the reclaimer up if it's sleeping.
+*/
+void  _reclaim_wake(void);
+
+/*
+* _prefault_request:
+* Asks the reclaimer to top up the prefault-ahead windows.  Called with
+* the heap lock held whenever a page group's window runs low.
+*/
+void  _prefault_request(void);
+
+/*
+* _prefault_run:
+* Populates the pages of every page group's prefault-ahead window that
+* aren't populated yet.  Only ever called from the reclaimer thread.
+*/
+void  _prefault_run(void);
+
+/*
+* _prefault_pinned:
+* Returns 1 if the reclaimer is populating 'pg' outside the heap lock,
+* 0 otherwise.  Called with the heap lock held.
+*/
+int   _prefault_pinned(struct _smalloc_pagegroup_t* pg);
+
+/*
+* _shm_publish:
+* Copies the current statistics into the exported shared memory segment.
+* Only ever called from the reclaimer thread.
+*/
+void  _shm_publish(void);
+#else
+/* Without a reclaimer nothing is ever populated behind the lock. */
+#define _prefault_pinned(pg)    (0)
+#endif
+
+/*
+* Public functions exposed in smalloc.h
+*/
+void *smalloc(size_t size)
+{
+    return smalloc_tagged(size, 0);
+}
+
+void *smalloc_tagged(size_t size, unsigned tag)
+{
+    if (tag >= SMALLOC_STATS_NTAGS) {
+        return NULL;
+    }
+    if (_heap && size) {
+        return _heap_alloc(_heap, size);
+    }
+
+    return _smalloc_tagged(size, tag);
+}
+
+void*
+_smalloc_tagged(size_t size, unsigned tag)
+{
+    void* ptr;
+
+#ifdef SMALLOC_DEBUG
+    fprintf(stdout, "INFO: smalloc: Asking for %lu bytes.\n", size);
+#endif
+
+    if (size == 0 || tag >= SMALLOC_STATS_NTAGS ||
+        size > (size_t)-1 - SMALLOC_ALIGNMENT) {
+        return NULL;
+    }
+    size = _SMALLOC_ROUND(size);
+
+    if (size <= SMALLOC_SLAB_MAX) {
+        return _arena_take(size, tag, &ptr, 1) ? ptr : NULL;
+    }
+
+    _smalloc_lock();
+
+    if (!_info.ready && _smalloc_init()) {
+#ifdef SMALLOC_DEBUG
+        fprintf(stderr, "ERROR: smalloc: Failed to initialization.\n");
+#endif
+        _smalloc_unlock();
+        return NULL;
+    }
+
+    ptr = _chunk_alloc_locked(size, tag, NULL);
+
+    _smalloc_unlock();
+
+#if SMALLOC_POPULATE_THRESHOLD
+    if (ptr && size >= SMALLOC_POPULATE_THRESHOLD) {
+        smalloc_populate(ptr, size, SMALLOC_POPULATE_THREADS);
+    }
+#endif
+
+    return ptr;
+}
+
+size_t smalloc_batch(size_t size, void **ptrs, size_t count)
+{
+    size_t n;
+
+    if (size == 0 || count == 0) {
+        return 0;
+    }
+    if (_heap) {
+        for (n = 0; n < count && (ptrs[n] = _heap_alloc(_heap, size)); n++) {
+        }
+        return n;
+    }
+    if (size > (size_t)-1 - SMALLOC_ALIGNMENT) {
+        return 0;
+    }
+    size = _SMALLOC_ROUND(size);
+
+    /*
+    * Small objects are pulled out of slab bitmaps many at a time; for
+    * anything bigger the batch only saves taking the lock per object.
+    */
+    if (size <= SMALLOC_SLAB_MAX) {
+        return _arena_take(size, 0, ptrs, count);
+    }
+
+    _smalloc_lock();
+
+    if (!_info.ready && _smalloc_init()) {
+        _smalloc_unlock();
+        return 0;
+    }
+
+    n = 0;
+    while (n < count && (ptrs[n] = _chunk_alloc_locked(size, 0, NULL))) {
+        n++;
+    }
+
+    _smalloc_unlock();
+
+    return n;
+}
+
+void* smalloc_multi(const size_t* sizes, const size_t* aligns, size_t n,
+    void** ptrs)
+{
+    size_t i, off, align, maxalign;
+    char* base;
+    char* p;
+
+    /* Lay the objects out from a maximally aligned start... */
+    maxalign = SMALLOC_ALIGNMENT;
+    off = 0;
+    for (i = 0; i < n; i++) {
+        if (aligns && (aligns[i] & (aligns[i] - 1))) {
+            return NULL;
+        }
+        align = aligns && aligns[i] > SMALLOC_ALIGNMENT ? aligns[i] :
+            SMALLOC_ALIGNMENT;
+        if (off + align - 1 < off) {
+            return NULL;
+        }
+        if (align > maxalign) {
+            maxalign = align;
+        }
+        off = (off + align - 1) & ~(align - 1);
+        if (off + sizes[i] < off) {
+            return NULL;
+        }
+        off += sizes[i];
+    }
+    if (off + maxalign < off) {
+        return NULL;
+    }
+
+    /*
+    * ...and find that start in one chunk, which only needs padding when
+    * some object wants more than the usual alignment.
+    */
+    off += maxalign - SMALLOC_ALIGNMENT;
+    base = smalloc(off ? off : 1);
+    if (base == NULL) {
+        return NULL;
+    }
+    p = (char*)(((size_t)base + maxalign - 1) & ~(maxalign - 1));
+
+    off = 0;
+    for (i = 0; i < n; i++) {
+        align = aligns && aligns[i] > SMALLOC_ALIGNMENT ? aligns[i] :
+            SMALLOC_ALIGNMENT;
+        off = (off + align - 1) & ~(align - 1);
+        ptrs[i] = p + off;
+        off += sizes[i];
+    }
+
+    return base;
+}
+
+void *scalloc(size_t nmemb, size_t size)
+{
+    void* ptr;
+    size_t len;
+    int fresh;
+
+    if (nmemb == 0 || size == 0) {
+        return NULL;
+    }
+    if (nmemb > (size_t)-1 / size ||
+        nmemb * size > (size_t)-1 - SMALLOC_ALIGNMENT) {
+        return NULL;
+    }
+    len = _SMALLOC_ROUND(nmemb * size);
+
+    if (_heap) {
+        ptr = _heap_alloc(_heap, len);
+        if (ptr) {
+            smalloc_memzero(ptr, len);
+        }
+        return ptr;
+    }
+
+    if (len <= SMALLOC_SLAB_MAX) {
+        if (_arena_take(len, 0, &ptr, 1) == 0) {
+            return NULL;
+        }
+        fresh = 0;
+    } else {
+        _smalloc_lock();
+        if (!_info.ready && _smalloc_init()) {
+            _smalloc_unlock();
+            return NULL;
+        }
+        ptr = _chunk_alloc_locked(len, 0, &fresh);
+        _smalloc_unlock();
+    }
+
+    /*
+    * Memory that has never been handed out is still zeroed by the OS;
+    * clearing it again would only fault in pages the caller may never
+    * touch.
+    */
+    if (ptr && !fresh) {
+        smalloc_memzero(ptr, len);
+    }
+
+    return ptr;
+}
+
+void *srealloc(void* ptr, size_t size)
+{
+    struct _smalloc_pagegroup_t* pg;
+    void* ret;
+    size_t old;
+
+    if (ptr == NULL) {
+        return smalloc(size);
+    }
+    if (size == 0) {
+        sfree(ptr);
+        return NULL;
+    }
+    if (size > (size_t)-1 - SMALLOC_ALIGNMENT) {
+        return NULL;
+    }
+
+    size = _SMALLOC_ROUND(size);
+
+    /*
+    * A slab's slot size can't change while it holds a live object, so
+    * slab objects need neither the heap lock nor a walk of the groups,
+    * and neither do objects of any thread's heap.  Only chunks can grow
+    * in place.
+    */
+    pg = _pagemap_get(ptr);
+    ret = NULL;
+    if (pg && pg->kind == _SMALLOC_PG_STACK) {
+        old = *(size_t*)((char*)ptr - _SMALLOC_HEAPHDR_SIZE);
+    } else if (pg) {
+        old = pg->slotsize;
+    } else {
+        _smalloc_lock();
+        old = _smalloc_usable_locked(ptr);
+        if (size > old) {
+            ret = _chunk_grow_locked(ptr, size);
+        }
+        _smalloc_unlock();
+    }
+
+    if (old == 0) {
+        old = _heap_usable(ptr);
+    }
+
+    if (old == 0) {
+#ifdef SMALLOC_DEBUG
+        fprintf(stderr, "ERROR: srealloc: %p was not allocated by "
+            "smalloc.\n", ptr);
+#endif
+        return NULL;
+    }
+    if (size <= old) {
+        return ptr;
+    }
+    if (ret) {
+        return ret;
+    }
+
+    ret = smalloc(size);
+    if (ret == NULL) {
+        return NULL;
+    }
+    smalloc_memcpy(ret, ptr, old);
+    sfree(ptr);
+
+    return ret;
+}
+
+struct smalloc_stack* smalloc_stack_create(void)
+{
+    struct _smalloc_pagegroup_t* pg;
+    struct smalloc_stack* st;
+
+    _smalloc_lock();
+    if (!_info.ready && _smalloc_init()) {
+        _smalloc_unlock();
+        return NULL;
+    }
+    pg = _pages_alloc(_SMALLOC_ROUND(sizeof(*st)), SMALLOC_STACK_PAGES);
+    _smalloc_unlock();
+    if (pg == NULL) {
+        return NULL;
+    }
+
+    pg->kind = _SMALLOC_PG_STACK;
+    st = (struct smalloc_stack*)pg->top;
+    pg->top = (char*)pg->top + _SMALLOC_ROUND(sizeof(*st));
+    pg->bytesfree -= _SMALLOC_ROUND(sizeof(*st));
+    st->first = st->cur = pg;
+    st->nmoves = 0;
+    st->heap = 0;
+    st->nextheap = NULL;
+
+    return st;
+}
+
+void* smalloc_stack_alloc(struct smalloc_stack* st, size_t size)
+{
+    struct _smalloc_pagegroup_t* pg = st->cur;
+    void* ptr;
+
+    if (size == 0 || size > (size_t)-1 - SMALLOC_ALIGNMENT) {
+        return NULL;
+    }
+    size = _SMALLOC_ROUND(size);
+
+    if (pg->bytesfree < size) {
+        return _stack_next(st, size);
+    }
+    ptr = pg->top;
+    pg->top = (char*)pg->top + size;
+    pg->bytesfree -= size;
+
+    return ptr;
+}
+
+struct smalloc_stack_mark smalloc_stack_mark(struct smalloc_stack* st)
+{
+    struct smalloc_stack_mark mark;
+
+    mark.group = st->cur;
+    mark.top = st->cur->top;
+
+    return mark;
+}
+
+void smalloc_stack_release(struct smalloc_stack* st,
+    struct smalloc_stack_mark mark)
+{
+    struct _smalloc_pagegroup_t* pg = mark.group;
+
+    /*
+    * Only the group the mark was taken in needs rewinding; the groups
+    * after it are rewound as _stack_next() moves back onto them.
+    */
+    pg->top = mark.top;
+    pg->bytesfree = (char*)pg + pg->npages * _info.pagesize - (char*)pg->top;
+    st->cur = pg;
+}
+
+void smalloc_stack_destroy(struct smalloc_stack* st)
+{
+    struct smalloc_stack** link;
+    struct _smalloc_pagegroup_t* pg;
+    struct _smalloc_pagegroup_t* next;
+
+    _smalloc_lock();
+    if (st->heap) {
+        for (link = &_info.heaps; *link != st; link = &(*link)->nextheap) {
+        }
+        *link = st->nextheap;
+        for (pg = st->first; pg; pg = pg->next) {
+            _pagemap_set(pg, NULL);
+        }
+    }
+
+    /* 'st' lives in the first group, so that one goes last. */
+    for (pg = st->first->next; pg; pg = next) {
+        next = pg->next;
+        _pages_release(pg);
+    }
+    _pages_release(st->first);
+    _smalloc_unlock();
+}
+
+void* smalloc_frame_alloc(size_t size)
+{
+    if (_frame.buf[0] == NULL && _frame_init()) {
+        return NULL;
+    }
+
+    return smalloc_stack_alloc(_frame.buf[_frame.cur], size);
+}
+
+void smalloc_frame_next(void)
+{
+    struct _smalloc_frame* f = &_frame;
+    struct smalloc_stack* st;
+    unsigned b;
+
+    if (f->buf[0] == NULL) {
+        return;
+    }
+
+    /*
+    * The buffer of the frame before last is free again.  Note how many
+    * groups that frame needed before rewinding it, and give back any the
+    * buffer hasn't needed in a while.
+    */
+    b = f->cur ^= 1;
+    st = f->buf[b];
+    if (st->nmoves + 1 > f->peak[b]) {
+        f->peak[b] = st->nmoves + 1;
+    }
+    smalloc_stack_release(st, f->start[b]);
+    st->nmoves = 0;
+
+    if (++f->quiet[b] >= SMALLOC_FRAME_QUIET) {
+        _stack_trim(st, f->peak[b]);
+        f->peak[b] = 0;
+        f->quiet[b] = 0;
+    }
+}
+
+struct smalloc_stack* smalloc_thread_set_heap(struct smalloc_stack* heap)
+{
+    struct smalloc_stack* prev = _heap;
+    struct _smalloc_pagegroup_t* pg;
+
+    /*
+    * Its objects have to be recognised after the scope ends too, and on
+    * other threads, so the stack stays registered until it is destroyed.
+    */
+    if (heap && !heap->heap) {
+        _smalloc_lock();
+        if (!heap->heap) {
+            for (pg = heap->first; pg; pg = pg->next) {
+                _pagemap_set(pg, pg);
+            }
+            heap->nextheap = _info.heaps;
+            _info.heaps = heap;
+            heap->heap = 1;
+        }
+        _smalloc_unlock();
+    }
+
+    _heap = heap;
+    return prev;
+}
+
+void smalloc_frame_free(void)
+{
+    if (_frame.buf[0] == NULL) {
+        return;
+    }
+
+    smalloc_stack_destroy(_frame.buf[0]);
+    smalloc_stack_destroy(_frame.buf[1]);
+    memset(&_frame, 0, sizeof(_frame));
+}
+
+struct smalloc_ring* smalloc_ring_create(size_t size)
+{
+    struct _smalloc_pagegroup_t* pg;
+    struct smalloc_ring* r;
+    size_t hdr;
+
+    hdr = _SMALLOC_ROUND(sizeof(*r));
+    if (size > (size_t)-1 - hdr - SMALLOC_ALIGNMENT) {
+        return NULL;
+    }
+    _smalloc_lock();
+    if (!_info.ready && _smalloc_init()) {
+        _smalloc_unlock();
+        return NULL;
+    }
+    pg = _pages_alloc(hdr + _SMALLOC_ROUND(size), 1);
+    _smalloc_unlock();
+    if (pg == NULL) {
+        return NULL;
+    }
+
+    /* The ring takes all of the group, including what rounding added. */
+    pg->kind = _SMALLOC_PG_RING;
+    r = (struct smalloc_ring*)pg->top;
+    r->pg = pg;
+    r->buf = (char*)pg->top + hdr;
+    r->cap = (_SMALLOC_PGLEN(pg) - hdr) & ~(size_t)(SMALLOC_ALIGNMENT - 1);
+    r->head = r->tail = 0;
+
+    return r;
+}
+
+void* smalloc_ring_alloc(struct smalloc_ring* r, size_t size)
+{
+    struct _ring_hdr* hdr;
+    size_t need, head, tail, off;
+
+    if (size == 0 || size > r->cap) {
+        return NULL;
+    }
+    need = _SMALLOC_RINGHDR_SIZE + _SMALLOC_ROUND(size);
+    if (need > r->cap) {
+        return NULL;
+    }
+
+    head = r->head;
+    tail = _atomic_load(&r->tail, __ATOMIC_ACQUIRE);
+    off = head % r->cap;
+
+    /* Messages never wrap; pad out the end of the ring instead. */
+    if (off + need > r->cap) {
+        if (head + (r->cap - off) + need - tail > r->cap) {
+            return NULL;
+        }
+        hdr = (struct _ring_hdr*)(r->buf + off);
+        hdr->len = r->cap - off;
+        hdr->freed = 1;
+        head += r->cap - off;
+        off = 0;
+    } else if (head + need - tail > r->cap) {
+        return NULL;
+    }
+
+    hdr = (struct _ring_hdr*)(r->buf + off);
+    hdr->len = need;
+    hdr->freed = 0;
+    _atomic_store(&r->head, head + need, __ATOMIC_RELEASE);
+
+    return (char*)hdr + _SMALLOC_RINGHDR_SIZE;
+}
+
+void smalloc_ring_free(struct smalloc_ring* r, void* ptr)
+{
+    struct _ring_hdr* hdr;
+    size_t head, tail;
+
+    if (ptr == NULL) {
+        return;
+    }
+
+    /*
+    * Mark the message, then reclaim everything freed from the tail on.
+    * That may be nothing if an older message is still live, or more than
+    * this message, such as the filler a wrap left in front of it.
+    */
+    hdr = (struct _ring_hdr*)((char*)ptr - _SMALLOC_RINGHDR_SIZE);
+    hdr->freed = 1;
+
+    head = _atomic_load(&r->head, __ATOMIC_ACQUIRE);
+    tail = r->tail;
+    while (tail != head) {
+        hdr = (struct _ring_hdr*)(r->buf + tail % r->cap);
+        if (!hdr->freed) {
+            break;
+        }
+        tail += hdr->len;
+    }
+    if (tail != r->tail) {
+        _atomic_store(&r->tail, tail, __ATOMIC_RELEASE);
+    }
+}
+
+void smalloc_ring_destroy(struct smalloc_ring* r)
+{
+    _smalloc_lock();
+    _pages_release(r->pg);
+    _smalloc_unlock();
+}
+
+void* smalloc_coro_alloc(size_t size)
+{
+    struct _coro_cache* c = _coro;
+    struct _coro_hdr* hdr;
+    size_t cls;
+
+    if (size == 0) {
+        return NULL;
+    }
+    if (size > SMALLOC_CORO_MAX) {
+        if (size > (size_t)-1 - _SMALLOC_COROHDR_SIZE) {
+            return NULL;
+        }
+        hdr = _smalloc_tagged(_SMALLOC_COROHDR_SIZE + size, 0);
+        if (hdr == NULL) {
+            return NULL;
+        }
+        hdr->owner = NULL;
+        return (char*)hdr + _SMALLOC_COROHDR_SIZE;
+    }
+
+    if (c == NULL && (c = _coro_init()) == NULL) {
+        return NULL;
+    }
+    cls = (size - 1) / SMALLOC_CORO_CLASS;
+#ifndef SMALLOC_SINGLE_THREADED
+    if (c->free[cls] == NULL && c->remote) {
+        _coro_drain(c);
+    }
+#endif
+
+    hdr = c->free[cls];
+    if (hdr) {
+        c->free[cls] = hdr->next;
+        c->count[cls]--;
+    } else {
+        hdr = _smalloc_tagged(_SMALLOC_COROHDR_SIZE +
+            (cls + 1) * SMALLOC_CORO_CLASS, 0);
+        if (hdr == NULL) {
+            return NULL;
+        }
+        hdr->owner = c;
+        hdr->cls = cls;
+    }
+
+    return (char*)hdr + _SMALLOC_COROHDR_SIZE;
+}
+
+void smalloc_coro_free(void* ptr)
+{
+    struct _coro_hdr* hdr;
+    struct _coro_cache* c;
+
+    if (ptr == NULL) {
+        return;
+    }
+    hdr = (struct _coro_hdr*)((char*)ptr - _SMALLOC_COROHDR_SIZE);
+    c = hdr->owner;
+    if (c == NULL) {
+        sfree(hdr);
+        return;
+    }
+
+#ifndef SMALLOC_SINGLE_THREADED
+    /* Resumed and destroyed on another thread: give it back remotely. */
+    if (c != _coro) {
+        struct _coro_hdr* head = c->remote;
+
+        do {
+            if (head == _CORO_RETIRED) {
+                sfree(hdr);
+                return;
+            }
+            hdr->next = head;
+        } while (!__atomic_compare_exchange_n(&c->remote, &head, hdr, 1,
+            __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        return;
+    }
+#endif
+
+    if (c->count[hdr->cls] >= SMALLOC_CORO_CACHE) {
+        sfree(hdr);
+        return;
+    }
+    hdr->next = c->free[hdr->cls];
+    c->free[hdr->cls] = hdr;
+    c->count[hdr->cls]++;
+}
+
+int smalloc_arena_snapshot(void)
+{
+#ifdef _WIN32
+    return -1;
+#else
+    struct _smalloc_arena* a;
+    size_t i;
+
+    /* Queued frees must land before the restore point is taken. */
+    sfree_async_flush();
+
+    _smalloc_lock();
+    if (!_info.memfd || _snap.active) {
+        _smalloc_unlock();
+        return -1;
+    }
+
+    /*
+    * Slabs and the pool change under their arena locks alone, so every
+    * one of those is held from before the memory is captured until the
+    * slab lists that describe it have been copied.
+    */
+    for (i = 0; i < SMALLOC_MAX_ARENAS; i++) {
+        _lock_acquire(&_arenas.arena[i].lock);
+    }
+
+    /*
+    * Switching the regions to private mappings of their files is the
+    * snapshot: from here on the files keep the pages as they are now.
+    */
+    for (i = 0; i < _info.nmemfds; i++) {
+        if (_memfd_remap(&_info.memfds[i], 1)) {
+            while (i-- > 0) {
+                _memfd_rewrite(&_info.memfds[i]);
+            }
+            for (i = SMALLOC_MAX_ARENAS; i-- > 0;) {
+                _lock_release(&_arenas.arena[i].lock);
+            }
+            _smalloc_unlock();
+            return -1;
+        }
+    }
+
+    _snap.active = 1;
+    _snap.nmemfds = _info.nmemfds;
+    _snap.pglist = _info.pglist;
+    _snap.slablist = _info.slablist;
+    _snap.heaps = _info.heaps;
+    _snap.regions = _info.regions;
+    _snap.spans = _info.spans;
+    _snap.stats = _info.stats;
+
+    for (i = 0; i < SMALLOC_MAX_ARENAS; i++) {
+        a = &_arenas.arena[i];
+        memcpy(_snap.slabs[i], a->slabs, sizeof(a->slabs));
+        _snap.astats[i] = a->stats;
+    }
+    _snap.pool = _pool.head;
+    _snap.npooled = _pool.npages;
+    _snap.ndirty = _pool.ndirty;
+    for (i = SMALLOC_MAX_ARENAS; i-- > 0;) {
+        _lock_release(&_arenas.arena[i].lock);
+    }
+    _smalloc_unlock();
+
+    return 0;
+#endif
+}
+
+int smalloc_arena_rollback(void)
+{
+#ifdef _WIN32
+    return -1;
+#else
+    struct smalloc_lock_stats lock;
+    struct _memfd_region* m;
+    struct _smalloc_arena* a;
+    size_t i;
+
+    sfree_async_flush();
+
+    _smalloc_lock();
+    if (!_snap.active) {
+        _smalloc_unlock();
+        return -1;
+    }
+
+    /*
+    * Frees find slabs and thread heaps through the page map, which must
+    * not be left pointing at groups that go away with the rollback.
+    */
+    for (i = 0; i < SMALLOC_MAX_ARENAS; i++) {
+        _lock_acquire(&_arenas.arena[i].lock);
+    }
+    _pagemap_slabs(_info.slablist, 0);
+    _pagemap_heaps(0);
+
+    /* Dropping the private copies is the rollback. */
+    for (i = 0; i < _snap.nmemfds; i++) {
+        _memfd_remap(&_info.memfds[i], 1);
+    }
+    for (i = _snap.nmemfds; i < _info.nmemfds; i++) {
+        m = &_info.memfds[i];
+        munmap(m->base, m->len);
+        munmap(m->meta, m->metalen);
+        close(m->fd);
+    }
+    _info.nmemfds = _snap.nmemfds;
+
+    _info.pglist = _snap.pglist;
+    _info.slablist = _snap.slablist;
+    _info.heaps = _snap.heaps;
+    _info.regions = _snap.regions;
+    _info.spans = _snap.spans;
+    _stats_begin();
+    lock = _info.stats.heap_lock;
+    _info.stats = _snap.stats;
+    _info.stats.heap_lock = lock;
+    _stats_end();
+    _pool.head = _snap.pool;
+    _pool.npages = _snap.npooled;
+    _pool.ndirty = _snap.ndirty;
+    _pagemap_slabs(_info.slablist, 1);
+    _pagemap_heaps(1);
+    for (i = 0; i < SMALLOC_MAX_ARENAS; i++) {
+        a = &_arenas.arena[i];
+        memcpy(a->slabs, _snap.slabs[i], sizeof(a->slabs));
+        _seq_begin(a->seq);
+        a->stats = _snap.astats[i];
+        _seq_end(a->seq);
+    }
+
+    /* Arenas dropped since the snapshot hand their slabs on again. */
+    for (i = _arenas.narenas; i < SMALLOC_MAX_ARENAS; i++) {
+        _arena_merge(&_arenas.arena[i],
+            &_arenas.arena[i % _arenas.narenas]);
+    }
+    for (i = SMALLOC_MAX_ARENAS; i-- > 0;) {
+        _lock_release(&_arenas.arena[i].lock);
+    }
+    _smalloc_unlock();
+
+    return 0;
+#endif
+}
+
+int smalloc_arena_commit(void)
+{
+#ifdef _WIN32
+    return -1;
+#else
+    size_t i;
+    int ret;
+
+    _smalloc_lock();
+    if (!_snap.active) {
+        _smalloc_unlock();
+        return -1;
+    }
+
+    ret = 0;
+    for (i = 0; i < _snap.nmemfds; i++) {
+        if (_memfd_rewrite(&_info.memfds[i])) {
+            ret = -1;
+        }
+    }
+    _snap.active = ret != 0;
+    _smalloc_unlock();
+
+    return ret;
+#endif
+}
+
+void sfree(void *ptr)
+{
+    struct _smalloc_pagegroup_t* pg;
+    struct _smalloc_arena* a;
+    int release, retired;
+
+    if (ptr == NULL) {
+        return;
+    }
+
+    /*
+    * Small objects only need their arena's lock.  Objects in a thread's
+    * heap, be it this thread's or not, go when the heap is released.
+    */
+    pg = _pagemap_get(ptr);
+    if (pg && pg->kind == _SMALLOC_PG_STACK) {
+        return;
+    }
+    if (pg) {
+        a = _slab_lock(pg);
+        retired = _slab_give(pg, ptr);
+        _lock_release(&a->lock);
+        if (retired) {
+            _pool_tick();
+        }
+        return;
+    }
+
+    _smalloc_lock();
+    release = _smalloc_free_locked(ptr);
+    if (release) {
+        _pgroup_cleanup(_info.pglist);
+    }
+    _smalloc_unlock();
+    if (release) {
+        _pool_tick();
+    }
+}
+
+int smalloc_populate(void *ptr, size_t len, int nthreads)
+{
+#ifdef _WIN32
+    volatile char* p;
+    volatile char* end = (char*)ptr + len;
+    SYSTEM_INFO si;
+
+    GetSystemInfo(&si);
+    for (p = ptr; p < end; p += si.dwPageSize) {
+        *p = *p;
+    }
+
+    return 0;
+#else
+    struct _populate_slice slices[_SMALLOC_POPULATE_MAX_THREADS];
+#ifdef _SMALLOC_THREADS
+    pthread_t threads[_SMALLOC_POPULATE_MAX_THREADS];
+#endif
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    size_t npages, per;
+    char* start;
+    char* end;
+    int i, started;
+
+    if (ptr == NULL || len == 0) {
+        return -1;
+    }
+
+    /* Widen the range to whole pages; madvise(2) wants it aligned. */
+    start = (char*)((uintptr_t)ptr & ~(uintptr_t)(pagesize - 1));
+    end = (char*)(((uintptr_t)ptr + len + pagesize - 1) &
+        ~(uintptr_t)(pagesize - 1));
+    npages = (end - start) / pagesize;
+
+#if SMALLOC_POPULATE_INTERLEAVE
+    _populate_interleave(start, end - start);
+#endif
+
+#ifdef _SMALLOC_THREADS
+    if (nthreads <= 0) {
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+#else
+    nthreads = 1;
+#endif
+    if (nthreads > _SMALLOC_POPULATE_MAX_THREADS) {
+        nthreads = _SMALLOC_POPULATE_MAX_THREADS;
+    }
+    /* Don't bother spreading less than 64 pages per thread around. */
+    if ((size_t)nthreads > npages / 64) {
+        nthreads = npages / 64;
+    }
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+
+    per = (npages + nthreads - 1) / nthreads;
+    for (i = 0; i < nthreads; i++) {
+        slices[i].start = start + i * per * pagesize;
+        slices[i].end = slices[i].start + per * pagesize;
+        if (slices[i].end > end) {
+            slices[i].end = end;
+        }
+        slices[i].pagesize = pagesize;
+    }
+
+    /* The calling thread takes the first slice itself. */
+    started = 1;
+#ifdef _SMALLOC_THREADS
+    for (i = 1; i < nthreads; i++) {
+        if (pthread_create(&threads[i], NULL, _populate_main, &slices[i])) {
+            break;
+        }
+        started++;
+    }
+#endif
+    for (i = started; i < nthreads; i++) {
+        _populate_main(&slices[i]);
+    }
+    _populate_main(&slices[0]);
+#ifdef _SMALLOC_THREADS
+    for (i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+#endif
+
+    for (i = 0; i < nthreads; i++) {
+        if (slices[i].err) {
+            errno = slices[i].err;
+            return -1;
+        }
+    }
+
+    return 0;
+#endif
+}
+
+void smalloc_memzero(void *dst, size_t len)
+{
+    if (len < _info.nt_threshold || _info.nt_threshold == 0) {
+        memset(dst, 0, len);
+        return;
+    }
+
+    _smalloc_nt_zero(dst, len);
+}
+
+void smalloc_memcpy(void *dst, const void *src, size_t len)
+{
+    if (len < _info.nt_threshold || _info.nt_threshold == 0) {
+        memcpy(dst, src, len);
+        return;
+    }
+
+    _smalloc_nt_copy(dst, src, len);
+}
+
+int smalloc_set_prefault(size_t npages)
+{
+#ifndef _SMALLOC_THREADS
+    return npages ? -1 : 0;
+#else
+    _smalloc_lock();
+    if (!_info.ready && _smalloc_init()) {
+        _smalloc_unlock();
+        return -1;
+    }
+    _info.prefault_pages = npages;
+    if (npages) {
+        _prefault_request();
+    }
+    _smalloc_unlock();
+
+    return 0;
+#endif
+}
+
+int smalloc_set_backend(int backend)
+{
+    int memfd, ret;
+
+    memfd = (backend & SMALLOC_BACKEND_MEMFD) != 0;
+    backend &= ~SMALLOC_BACKEND_MEMFD;
+    if (memfd && backend == SMALLOC_BACKEND_MMAP) {
+        return -1;
+    }
+
+#ifdef _WIN32
+    if (backend != SMALLOC_BACKEND_MMAP) {
+        return -1;
+    }
+#else
+    if (backend != SMALLOC_BACKEND_MMAP && backend != SMALLOC_BACKEND_BUDDY &&
+        backend != SMALLOC_BACKEND_SPAN) {
+        return -1;
+    }
+#endif
+
+    /* Page groups can't move between backends, so only switch early. */
+    ret = -1;
+    _smalloc_lock();
+    if (!_info.ready && _smalloc_init()) {
+        _smalloc_unlock();
+        return -1;
+    }
+    if (_info.pglist == NULL && _info.slablist == NULL &&
+        _info.inherited == NULL) {
+        _info.backend = backend;
+        _info.memfd = memfd;
+        ret = 0;
+    }
+    _smalloc_unlock();
+
+    return ret;
+}
+
+int smalloc_set_simd(int level)
+{
+    _smalloc_lock();
+    if (!_info.ready && _smalloc_init()) {
+        _smalloc_unlock();
+        return -1;
+    }
+    level = _smalloc_set_simd_locked(level);
+    _smalloc_unlock();
+
+    return level;
+}
+
+int smalloc_set_fork_policy(int policy)
+{
+    if (policy != SMALLOC_FORK_SHARE && policy != SMALLOC_FORK_FRESH) {
+        return -1;
+    }
+
+    _smalloc_lock();
+    _info.fork_policy = policy;
+    _smalloc_unlock();
+
+    return 0;
+}
+
+int smalloc_set_arenas(unsigned n)
+{
+#ifdef SMALLOC_SINGLE_THREADED
+    return n > 1 ? -1 : 0;
+#else
+    if (n > SMALLOC_MAX_ARENAS) {
+        return -1;
+    }
+
+    _arenas.fixed = n != 0;
+    if (n && n != _arenas.narenas) {
+        _arena_resize(n);
+    }
+
+    return 0;
+#endif
+}
+
+int smalloc_set_decay(unsigned ms)
+{
+    _smalloc_lock();
+    _pool.decay_ms = ms;
+    _pool_decay(_pool_now());
+    _smalloc_unlock();
+
+    return 0;
+}
+
+int smalloc_stats(struct smalloc_stats *st)
+{
+    struct _arena_stats as;
+    struct _smalloc_arena* a;
+    unsigned seq, i;
+    int c;
+
+    if (st == NULL) {
+        return -1;
+    }
+
+    do {
+        seq = _atomic_load(&_info.stats_seq, __ATOMIC_ACQUIRE);
+        *st = _info.stats;
+        _atomic_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != _info.stats_seq);
+
+    /*
+    * The lock and pool counters are bumped outside the sequence lock;
+    * each one is a single word and is read as it stands.
+    */
+    st->heap_lock = _info.lock.stats;
+    st->bytes_pooled = _pool.npages * _info.pagesize;
+    st->bytes_pooled_dirty = _pool.ndirty * _info.pagesize;
+
+    /*
+    * Each arena's share is consistent in itself, but the arenas and the
+    * heap are read one after the other.
+    */
+    st->narenas = _arenas.narenas;
+    for (i = 0; i < SMALLOC_MAX_ARENAS; i++) {
+        a = &_arenas.arena[i];
+        do {
+            seq = _atomic_load(&a->seq, __ATOMIC_ACQUIRE);
+            as = a->stats;
+            _atomic_fence(__ATOMIC_ACQUIRE);
+        } while ((seq & 1) || seq != a->seq);
+
+        st->bytes_allocated += as.bytes_allocated;
+        st->nchunks += as.nchunks;
+        for (c = 0; c < SMALLOC_STATS_NCLASSES; c++) {
+            st->nchunks_class[c] += as.nchunks_class[c];
+        }
+        for (c = 0; c < SMALLOC_STATS_NTAGS; c++) {
+            st->bytes_tagged[c] += as.bytes_tagged[c];
+        }
+        st->nallocs += as.nallocs;
+        st->nfrees += as.nfrees;
+
+        if (i < SMALLOC_STATS_NARENAS) {
+            st->arena_threads[i] = a->nthreads;
+            st->arena_lock[i] = a->lock.stats;
+        }
+    }
+
+    return 0;
+}
+
+int smalloc_shm_export(const char *name, unsigned interval_ms)
+{
+#ifndef _SMALLOC_THREADS
+    return -1;
+#else
+    struct smalloc_shm_segment* seg;
+    int fd;
+
+    if (_shm.seg) {
+        return -1;
+    }
+
+    /* Make sure the page size is known before the first publish. */
+    _smalloc_lock();
+    if (!_info.ready && _smalloc_init()) {
+        _smalloc_unlock();
+        return -1;
+    }
+    _smalloc_unlock();
+
+    if (name == NULL || name[0] == '\0') {
+        snprintf(_shm.name, sizeof(_shm.name), SMALLOC_SHM_NAME_FMT,
+            (long)getpid());
+    } else if (strlen(name) < sizeof(_shm.name)) {
+        strcpy(_shm.name, name);
+    } else {
+        return -1;
+    }
+
+    fd = shm_open(_shm.name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(*seg))) {
+        close(fd);
+        shm_unlink(_shm.name);
+        return -1;
+    }
+    seg = mmap(0, sizeof(*seg), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED) {
+        shm_unlink(_shm.name);
+        return -1;
+    }
+
+    seg->magic = SMALLOC_SHM_MAGIC;
+    seg->version = SMALLOC_SHM_VERSION;
+    seg->pid = getpid();
+    seg->interval_ms = interval_ms ? interval_ms : 1000;
+    _shm.seg = seg;
+
+    /* Publish once right away so a viewer never sees an empty segment. */
+    _shm_publish();
+
+    _reclaim.tick = seg->interval_ms;
+    if (_reclaim_start()) {
+        smalloc_shm_unexport();
+        return -1;
+    }
+    _reclaim_wake();
+
+    return 0;
+#endif
+}
+
+void smalloc_shm_unexport(void)
+{
+#ifdef _SMALLOC_THREADS
+    struct smalloc_shm_segment* seg = _shm.seg;
+
+    if (seg == NULL) {
+        return;
+    }
+
+    /*
+    * The reclaimer may be in the middle of a publish; leave the mapping
+    * in place and only stop updating it.  Viewers notice the segment
+    * is gone once it has been unlinked.
+    */
+    _reclaim.tick = 0;
+    _shm.seg = NULL;
+    shm_unlink(_shm.name);
+#endif
+}
+
+void sfree_async(void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+
+#ifndef _SMALLOC_THREADS
+    sfree(ptr);
+#else
+    /*
+    * Objects in a thread's heap are freed with the heap, as in sfree();
+    * the reclaimer couldn't find them and might outlive the heap.
+    */
+    if (_heap_usable(ptr)) {
+        return;
+    }
+    _reclaim_push(ptr, ptr, 1);
+#endif
+}
+
+void sfree_async_bulk(void **ptrs, size_t count)
+{
+#ifndef _SMALLOC_THREADS
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        sfree(ptrs[i]);
+    }
+#else
+    void* first = NULL;
+    void* last = NULL;
+    size_t i, n;
+
+    /*
+    * Link the whole array into one chain first so that it costs a single
+    * compare-and-swap to hand it to the reclaimer.
+    */
+    n = 0;
+    for (i = 0; i < count; i++) {
+        if (ptrs[i] == NULL || _heap_usable(ptrs[i])) {
+            continue;
+        }
+        if (last) {
+            *(void**)last = ptrs[i];
+        } else {
+            first = ptrs[i];
+        }
+        last = ptrs[i];
+        n++;
+    }
+
+    if (n) {
+        _reclaim_push(first, last, n);
+    }
+#endif
+}
+
+void sfree_async_flush(void)
+{
+#ifdef _SMALLOC_THREADS
+    void* list;
+
+    /*
+    * Free whatever is still queued on the calling thread, then wait out
+    * any batch the reclaimer has already taken off the stack.
+    */
+    list = __sync_lock_test_and_set(&_reclaim.head, NULL);
+    if (list) {
+        _reclaim_batch(list);
+    }
+    while (_reclaim.pending) {
+        sched_yield();
+    }
+#endif
+}
+
+int
+_smalloc_init(void)
+{
+    /* Determine the page size of the underlying OS */
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    _info.pagesize = si.dwPageSize;
+    _info.heap_ptr = GetProcessHeap();
+    if (_info.heap_ptr == NULL) {
+#ifdef SMALLOC_DEBUG
+        fprintf(stderr, "ERROR: _smalloc_init: Failed to get heap pointer "
+            "from GetProcessHeap() call.\n");
+#endif
+        return -1;
+    }
+#else
+    _info.pagesize = sysconf(_SC_PAGESIZE);
+    if (pthread_atfork(_fork_prepare, _fork_parent, _fork_child)) {
+#ifdef SMALLOC_DEBUG
+        fprintf(stderr, "ERROR: _smalloc_init: Failed to register fork "
+            "handlers.\n");
+#endif
+        return -1;
+    }
+#endif
+    _smalloc_set_simd_locked(SMALLOC_SIMD_AVX2);
+
+    _info.nt_threshold = SMALLOC_NT_THRESHOLD;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    if (_info.nt_threshold == 0 && sysconf(_SC_LEVEL3_CACHE_SIZE) > 0) {
+        _info.nt_threshold = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    }
+#endif
+    if (_info.nt_threshold == 0) {
+        _info.nt_threshold = 8 * 1024 * 1024;
+    }
+
+#ifdef _SMALLOC_THREADS
+    _info.prefault_pages = SMALLOC_PREFAULT_PAGES;
+#endif
+#ifndef _WIN32
+    _info.backend = SMALLOC_BACKEND;
+#endif
+
+    _info.ready = 1;
+
+    return 0;
+}
+
+void*
+_chunk_alloc_locked(size_t size, unsigned tag, int* fresh)
+{
+    struct _smalloc_chunk_t* chk;
+    struct _smalloc_pagegroup_t* pg;
+
+    /*
+    * Look through the existing list of pages and see if we have any
+    * groups of the right tag that can support the size request.
+    */
+    pg = _info.pglist;
+    while (pg && (pg->tag != tag || !_pgroup_fits(pg, size))) {
+        pg = pg->next;
+    }
+
+    /*
+    * If we weren't able to find a page group to support the
+    * memory request in the above while() loop, we must ask
+    * the OS for more pages with a call to _pages_alloc.
+    */
+    if (!pg) {
+#ifdef SMALLOC_DEBUG
+        fprintf(stdout, "INFO: smalloc: No page group was found "
+            "to support %lu bytes.\n", size);
+#endif
+        pg = _pages_alloc(size, SMALLOC_SMALLEST_PAGE_GROUP);
+        if (!pg) {
+#ifdef SMALLOC_DEBUG
+            fprintf(stderr, "ERROR: smalloc: Failed to allocate %lu "
+                "bytes.\n", size);
+#endif
+            return NULL;
+        }
+        pg->tag = tag;
+
+        /*
+        * Once the page group has been successfully allocated,
+        * ensure the reference to the group isn't left dangling.
+        * Append it to the list of pages in the _info structure.
+        */
+        _pgroup_append(&_info.pglist, pg);
+    }
+
+    /*
+    * Ask for a chunk from the page group.  When we get the chunk, all
+    * the internal metadata will not be initialized.  Do that here.
+    */
+    if (fresh) {
+        *fresh = (char*)pg->top >= (char*)pg + pg->hiwater;
+    }
+    chk = _pgroup_reserve(pg, size);
+#ifndef SMALLOC_COMPACT
+    chk->ptr = (char*)chk + _SMALLOC_CHKHDR_SIZE;
+#endif
+    chk->len = size;
+    chk->freed = 0;
+
+    return (char*)chk + _SMALLOC_CHKHDR_SIZE;
+}
+
+void*
+_stack_next(struct smalloc_stack* st, size_t size)
+{
+    struct _smalloc_pagegroup_t* pg = st->cur->next;
+
+    if (pg == NULL || _SMALLOC_PGLEN(pg) < size) {
+        _smalloc_lock();
+        pg = _pages_alloc(size, SMALLOC_STACK_PAGES);
+        if (pg) {
+            pg->kind = _SMALLOC_PG_STACK;
+            if (st->heap) {
+                _pagemap_set(pg, pg);
+            }
+        }
+        _smalloc_unlock();
+        if (pg == NULL) {
+            return NULL;
+        }
+        pg->next = st->cur->next;
+        st->cur->next = pg;
+    }
+
+    pg->top = (char*)pg + _SMALLOC_PGHDR_SIZE + size;
+    pg->bytesfree = _SMALLOC_PGLEN(pg) - size;
+    st->cur = pg;
+    st->nmoves++;
+
+    return (char*)pg + _SMALLOC_PGHDR_SIZE;
+}
+
+void*
+_heap_alloc(struct smalloc_stack* st, size_t size)
+{
+    char* ptr;
+
+    if (size > (size_t)-1 - _SMALLOC_HEAPHDR_SIZE) {
+        return NULL;
+    }
+    ptr = smalloc_stack_alloc(st, _SMALLOC_HEAPHDR_SIZE + size);
+    if (ptr == NULL) {
+        return NULL;
+    }
+    *(size_t*)ptr = _SMALLOC_ROUND(size);
+
+    return ptr + _SMALLOC_HEAPHDR_SIZE;
+}
+
+size_t
+_heap_usable(void* ptr)
+{
+    struct _smalloc_pagegroup_t* pg;
+#ifdef _WIN32
+    _smalloc_lock();
+    pg = _pgroup_owner(ptr);
+    _smalloc_unlock();
+#else
+    pg = _pagemap_get(ptr);
+#endif
+    if (pg == NULL || pg->kind != _SMALLOC_PG_STACK) {
+        return 0;
+    }
+
+    return *(size_t*)((char*)ptr - _SMALLOC_HEAPHDR_SIZE);
+}
+
+void
+_stack_trim(struct smalloc_stack* st, size_t keep)
+{
+    struct _smalloc_pagegroup_t* pg;
+    struct _smalloc_pagegroup_t* next;
+    size_t n;
+
+    for (pg = st->first, n = 1; pg && n < keep; pg = pg->next, n++) {
+    }
+    if (pg == NULL || pg->next == NULL) {
+        return;
+    }
+
+    next = pg->next;
+    pg->next = NULL;
+
+    _smalloc_lock();
+    while ((pg = next) != NULL) {
+        next = pg->next;
+        if (st->heap) {
+            _pagemap_set(pg, NULL);
+        }
+        _pages_release(pg);
+    }
+    _smalloc_unlock();
+}
+
+#ifdef _SMALLOC_THREADS
+static pthread_key_t _frame_key;
+static pthread_once_t _frame_once = PTHREAD_ONCE_INIT;
+
+/* Frees an exiting thread's frame buffers. */
+static void
+_frame_exit(void* arg)
+{
+    smalloc_frame_free();
+}
+
+static void
+_frame_key_init(void)
+{
+    pthread_key_create(&_frame_key, _frame_exit);
+}
+#endif
+
+int
+_frame_init(void)
+{
+    struct _smalloc_frame* f = &_frame;
+
+    f->buf[0] = smalloc_stack_create();
+    f->buf[1] = smalloc_stack_create();
+    if (f->buf[0] == NULL || f->buf[1] == NULL) {
+        if (f->buf[0]) {
+            smalloc_stack_destroy(f->buf[0]);
+        }
+        if (f->buf[1]) {
+            smalloc_stack_destroy(f->buf[1]);
+        }
+        f->buf[0] = f->buf[1] = NULL;
+        return -1;
+    }
+    f->start[0] = smalloc_stack_mark(f->buf[0]);
+    f->start[1] = smalloc_stack_mark(f->buf[1]);
+    f->cur = 0;
+
+#ifdef _SMALLOC_THREADS
+    /* Any non-NULL value gets the destructor run at thread exit. */
+    pthread_once(&_frame_once, _frame_key_init);
+    pthread_setspecific(_frame_key, f);
+#endif
+
+    return 0;
+}
+
+/*
+* The caches of exited threads, waiting for new threads to take them,
+* and every cache there is.  Protected by the heap lock.
+*/
+static struct _coro_cache* _coro_retired;
+static struct _coro_cache* _coro_all;
+
+#ifdef _SMALLOC_THREADS
+static pthread_key_t _coro_key;
+static pthread_once_t _coro_once = PTHREAD_ONCE_INIT;
+
+static void
+_coro_exit(void* arg)
+{
+    _coro = NULL;
+    _coro_retire(arg);
+}
+
+void
+_coro_retire(struct _coro_cache* c)
+{
+    struct _coro_hdr* hdr;
+    struct _coro_hdr* next;
+    size_t cls;
+
+    /* From here on other threads free this cache's frames themselves. */
+    hdr = __atomic_exchange_n(&c->remote, _CORO_RETIRED, __ATOMIC_ACQUIRE);
+    for (; hdr; hdr = next) {
+        next = hdr->next;
+        sfree(hdr);
+    }
+    for (cls = 0; cls < _SMALLOC_NCOROCLASSES; cls++) {
+        while ((hdr = c->free[cls]) != NULL) {
+            c->free[cls] = hdr->next;
+            sfree(hdr);
+        }
+        c->count[cls] = 0;
+    }
+
+    _smalloc_lock();
+    c->link = _coro_retired;
+    _coro_retired = c;
+    _smalloc_unlock();
+}
+
+static void
+_coro_key_init(void)
+{
+    pthread_key_create(&_coro_key, _coro_exit);
+}
+#endif
+
+struct _coro_cache*
+_coro_init(void)
+{
+    struct _coro_cache* c;
+
+    _smalloc_lock();
+    c = _coro_retired;
+    if (c) {
+        _coro_retired = c->link;
+    }
+    _smalloc_unlock();
+
+    if (c == NULL) {
+        c = _smalloc_tagged(sizeof(*c), 0);
+        if (c == NULL) {
+            return NULL;
+        }
+        memset(c, 0, sizeof(*c));
+        _smalloc_lock();
+        c->all = _coro_all;
+        _coro_all = c;
+        _smalloc_unlock();
+    } else {
+        _atomic_store(&c->remote, NULL, __ATOMIC_RELEASE);
+    }
+    _coro = c;
+
+#ifdef _SMALLOC_THREADS
+    pthread_once(&_coro_once, _coro_key_init);
+    pthread_setspecific(_coro_key, c);
+#endif
+
+    return c;
+}
+
+#ifndef SMALLOC_SINGLE_THREADED
+void
+_coro_drain(struct _coro_cache* c)
+{
+    struct _coro_hdr* hdr;
+    struct _coro_hdr* next;
+
+    hdr = __atomic_exchange_n(&c->remote, NULL, __ATOMIC_ACQUIRE);
+    for (; hdr; hdr = next) {
+        next = hdr->next;
+        if (c->count[hdr->cls] >= SMALLOC_CORO_CACHE) {
+            sfree(hdr);
+            continue;
+        }
+        hdr->next = c->free[hdr->cls];
+        c->free[hdr->cls] = hdr;
+        c->count[hdr->cls]++;
+    }
+}
+#endif
+
+void*
+_chunk_grow_locked(void* ptr, size_t size)
+{
+    struct _smalloc_pagegroup_t** link;
+    struct _smalloc_pagegroup_t* pg;
+    struct _smalloc_chunk_t* chk;
+    size_t need, newpages;
+    ptrdiff_t delta;
+    char* base;
+
+    pg = _pgroup_find(_info.pglist, ptr);
+    if (pg == NULL) {
+        return NULL;
+    }
+    chk = (struct _smalloc_chunk_t*)((char*)ptr - _SMALLOC_CHKHDR_SIZE);
+    if ((char*)ptr + chk->len != pg->top) {
+        return NULL;
+    }
+
+    need = size - chk->len;
+    if (pg->bytesfree < need) {
+        newpages = ((char*)ptr + size - (char*)pg + _info.pagesize - 1) /
+            _info.pagesize;
+        if (newpages > _SMALLOC_SIZE_MAX / _info.pagesize ||
+            newpages > UINT32_MAX) {
+            return NULL;
+        }
+        /*
+        * The reclaimer may be populating the group with the heap lock
+        * dropped, so it has to stay where it is until it is unpinned.
+        */
+        base = _extent_grow(pg, pg->npages, &newpages,
+            pg->nlive == 1 && !_prefault_pinned(pg));
+        if (base == NULL) {
+            return NULL;
+        }
+
+        /* Fix up every pointer into the group if it had to move. */
+        if (base != (char*)pg) {
+            for (link = &_info.pglist; *link != pg; link = &(*link)->next) {
+            }
+            delta = base - (char*)pg;
+            pg = *link = (struct _smalloc_pagegroup_t*)base;
+            pg->top += delta;
+#ifndef SMALLOC_COMPACT
+            pg->chunks = (struct _smalloc_chunk_t*)((char*)pg->chunks + delta);
+            for (chk = pg->chunks; chk->next; chk = chk->next) {
+                chk->ptr = (char*)chk->ptr + delta;
+                chk->next = (struct _smalloc_chunk_t*)((char*)chk->next +
+                    delta);
+            }
+            chk->ptr = (char*)chk->ptr + delta;
+#endif
+            ptr = (char*)ptr + delta;
+            chk = (struct _smalloc_chunk_t*)((char*)ptr - _SMALLOC_CHKHDR_SIZE);
+        }
+
+        _stats_begin();
+        _info.stats.bytes_mapped += (newpages - pg->npages) * _info.pagesize;
+        _stats_end();
+        pg->bytesfree += (newpages - pg->npages) * _info.pagesize;
+        pg->npages = newpages;
+    }
+
+    pg->top += need;
+    pg->bytesfree -= need;
+    if ((char*)pg->top - (char*)pg > pg->hiwater) {
+        pg->hiwater = (char*)pg->top - (char*)pg;
+    }
+
+#ifndef SMALLOC_COMPACT
+    _stats_begin();
+    _info.stats.bytes_allocated += need;
+    _info.stats.nchunks_class[_stats_class(chk->len)]--;
+    _info.stats.nchunks_class[_stats_class(size)]++;
+    _info.stats.bytes_tagged[pg->tag] += need;
+    _stats_end();
+#endif
+    chk->len = size;
+
+    return ptr;
+}
+
+static size_t
+_bitmap_scan_scalar(const uint64_t* map, size_t nwords, size_t start)
+{
+    while (start < nwords && map[start] == 0) {
+        start++;
+    }
+
+    return start;
+}
+
+#ifdef _SMALLOC_X86
+/*
+* The vector scanners only skip over runs of empty words; once a vector
+* with a set bit turns up, the scalar scanner pins down the exact word.
+*/
+__attribute__((target("sse2"))) static size_t
+_bitmap_scan_sse2(const uint64_t* map, size_t nwords, size_t start)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i v;
+
+    while (start + 2 <= nwords) {
+        v = _mm_loadu_si128((const __m128i*)(map + start));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xFFFF) {
+            break;
+        }
+        start += 2;
+    }
+
+    return _bitmap_scan_scalar(map, nwords, start);
+}
+
+__attribute__((target("avx2"))) static size_t
+_bitmap_scan_avx2(const uint64_t* map, size_t nwords, size_t start)
+{
+    __m256i v;
+
+    while (start + 4 <= nwords) {
+        v = _mm256_loadu_si256((const __m256i*)(map + start));
+        if (!_mm256_testz_si256(v, v)) {
+            break;
+        }
+        start += 4;
+    }
+
+    return _bitmap_scan_scalar(map, nwords, start);
+}
+#endif
+
+#ifndef _WIN32
+void*
+_populate_main(void* arg)
+{
+    struct _populate_slice* slice = arg;
+    char* p;
+
+    slice->err = 0;
+    if (slice->start >= slice->end) {
+        return NULL;
+    }
+    do {
+        if (madvise(slice->start, slice->end - slice->start,
+            MADV_POPULATE_WRITE) == 0) {
+            return NULL;
+        }
+    } while (errno == EINTR);
+
+    /*
+    * EINVAL also covers ranges the kernel can't populate, PROT_NONE
+    * or read-only ones; an empty range tells whether it knows the
+    * advice at all.
+    */
+    if ((errno != EINVAL && errno != ENOSYS) ||
+        (errno == EINVAL && madvise(slice->start, 0,
+        MADV_POPULATE_WRITE) == 0)) {
+        slice->err = errno;
+        return NULL;
+    }
+
+    /*
+    * Older kernels don't know MADV_POPULATE_WRITE.  Write every page
+    * without changing what's in it.
+    */
+    for (p = slice->start; p < slice->end; p += slice->pagesize) {
+#ifdef SMALLOC_SINGLE_THREADED
+        *(volatile char*)p = *p;
+#else
+        __sync_fetch_and_or(p, 0);
+#endif
+    }
+
+    return NULL;
+}
+
+void
+_populate_interleave(void* start, size_t len)
+{
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_get_mempolicy)
+    unsigned long nodes[16];
+
+    /* MPOL_F_MEMS_ALLOWED is 4, MPOL_INTERLEAVE is 3. */
+    memset(nodes, 0, sizeof(nodes));
+    if (syscall(SYS_get_mempolicy, NULL, nodes, sizeof(nodes) * 8, NULL,
+        4) == 0) {
+        syscall(SYS_mbind, start, len, 3, nodes, sizeof(nodes) * 8, 0);
+    }
+#endif
+}
+#endif
+
+#ifdef _SMALLOC_X86
+/*
+* The streaming kernels write through with plain stores until 'dst' is
+* aligned to the vector width, stream the aligned middle, and finish the
+* tail with plain stores again; a buffer shorter than the misalignment
+* is written entirely by the head.  The fence makes the streamed data
+* visible before the caller can hand the memory to another thread.
+*/
+__attribute__((target("sse2"))) static void
+_nt_zero_sse2(char* dst, size_t len)
+{
+    __m128i zero = _mm_setzero_si128();
+    size_t head;
+
+    head = (16 - ((uintptr_t)dst & 15)) & 15;
+    if (head > len) {
+        head = len;
+    }
+    memset(dst, 0, head);
+    dst += head;
+    len -= head;
+
+    for (; len >= 64; dst += 64, len -= 64) {
+        _mm_stream_si128((__m128i*)dst, zero);
+        _mm_stream_si128((__m128i*)(dst + 16), zero);
+        _mm_stream_si128((__m128i*)(dst + 32), zero);
+        _mm_stream_si128((__m128i*)(dst + 48), zero);
+    }
+    _mm_sfence();
+    memset(dst, 0, len);
+}
+
+__attribute__((target("avx2"))) static void
+_nt_zero_avx2(char* dst, size_t len)
+{
+    __m256i zero = _mm256_setzero_si256();
+    size_t head;
+
+    head = (32 - ((uintptr_t)dst & 31)) & 31;
+    if (head > len) {
+        head = len;
+    }
+    memset(dst, 0, head);
+    dst += head;
+    len -= head;
+
+    for (; len >= 128; dst += 128, len -= 128) {
+        _mm256_stream_si256((__m256i*)dst, zero);
+        _mm256_stream_si256((__m256i*)(dst + 32), zero);
+        _mm256_stream_si256((__m256i*)(dst + 64), zero);
+        _mm256_stream_si256((__m256i*)(dst + 96), zero);
+    }
+    _mm_sfence();
+    memset(dst, 0, len);
+}
+
+__attribute__((target("sse2"))) static void
+_nt_copy_sse2(char* dst, const char* src, size_t len)
+{
+    size_t head;
+
+    head = (16 - ((uintptr_t)dst & 15)) & 15;
+    if (head > len) {
+        head = len;
+    }
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    len -= head;
+
+    for (; len >= 64; dst += 64, src += 64, len -= 64) {
+        _mm_stream_si128((__m128i*)dst,
+            _mm_loadu_si128((const __m128i*)src));
+        _mm_stream_si128((__m128i*)(dst + 16),
+            _mm_loadu_si128((const __m128i*)(src + 16)));
+        _mm_stream_si128((__m128i*)(dst + 32),
+            _mm_loadu_si128((const __m128i*)(src + 32)));
+        _mm_stream_si128((__m128i*)(dst + 48),
+            _mm_loadu_si128((const __m128i*)(src + 48)));
+    }
+    _mm_sfence();
+    memcpy(dst, src, len);
+}
+
+__attribute__((target("avx2"))) static void
+_nt_copy_avx2(char* dst, const char* src, size_t len)
+{
+    size_t head;
+
+    head = (32 - ((uintptr_t)dst & 31)) & 31;
+    if (head > len) {
+        head = len;
+    }
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    len -= head;
+
+    for (; len >= 128; dst += 128, src += 128, len -= 128) {
+        _mm256_stream_si256((__m256i*)dst,
+            _mm256_loadu_si256((const __m256i*)src));
+        _mm256_stream_si256((__m256i*)(dst + 32),
+            _mm256_loadu_si256((const __m256i*)(src + 32)));
+        _mm256_stream_si256((__m256i*)(dst + 64),
+            _mm256_loadu_si256((const __m256i*)(src + 64)));
+        _mm256_stream_si256((__m256i*)(dst + 96),
+            _mm256_loadu_si256((const __m256i*)(src + 96)));
+    }
+    _mm_sfence();
+    memcpy(dst, src, len);
+}
+#endif
+
+void
+_smalloc_nt_zero(void* dst, size_t len)
+{
+#ifdef _SMALLOC_X86
+    if (_info.simd == SMALLOC_SIMD_AVX2) {
+        _nt_zero_avx2(dst, len);
+        return;
+    }
+    if (_info.simd == SMALLOC_SIMD_SSE2) {
+        _nt_zero_sse2(dst, len);
+        return;
+    }
+#endif
+    memset(dst, 0, len);
+}
+
+void
+_smalloc_nt_copy(void* dst, const void* src, size_t len)
+{
+#ifdef _SMALLOC_X86
+    if (_info.simd == SMALLOC_SIMD_AVX2) {
+        _nt_copy_avx2(dst, src, len);
+        return;
+    }
+    if (_info.simd == SMALLOC_SIMD_SSE2) {
+        _nt_copy_sse2(dst, src, len);
+        return;
+    }
+#endif
+    memcpy(dst, src, len);
+}
+
+int
+_smalloc_set_simd_locked(int level)
+{
+#ifdef _SMALLOC_X86
+    __builtin_cpu_init();
+    if (level >= SMALLOC_SIMD_AVX2 && __builtin_cpu_supports("avx2")) {
+        _info.scan = _bitmap_scan_avx2;
+        return _info.simd = SMALLOC_SIMD_AVX2;
+    }
+    if (level >= SMALLOC_SIMD_SSE2 && __builtin_cpu_supports("sse2")) {
+        _info.scan = _bitmap_scan_sse2;
+        return _info.simd = SMALLOC_SIMD_SSE2;
+    }
+#endif
+    _info.scan = _bitmap_scan_scalar;
+    return _info.simd = SMALLOC_SIMD_SCALAR;
+}
+
+struct _smalloc_pagegroup_t*
+_slab_find(struct _smalloc_arena* a, size_t size, unsigned tag)
+{
+    struct _smalloc_pagegroup_t* pg;
+
+    for (pg = a->slabs[size / SMALLOC_ALIGNMENT - 1]; pg; pg = pg->slabnext) {
+        if (pg->tag == tag && pg->nlive < pg->nslots) {
+            return pg;
+        }
+    }
+
+    return NULL;
+}
+
+struct _smalloc_pagegroup_t*
+_slab_new(struct _smalloc_arena* a, size_t size, unsigned tag)
+{
+    struct _smalloc_pagegroup_t* pg;
+    size_t pages;
+
+    pages = (size * SMALLOC_SLAB_SLOTS + _info.pagesize - 1) / _info.pagesize;
+    if (pages < SMALLOC_SLAB_PAGES) {
+        pages = SMALLOC_SLAB_PAGES;
+    }
+    pg = _pages_alloc(0, pages);
+    if (pg == NULL) {
+        return NULL;
+    }
+    pg->next = _info.slablist;
+    _info.slablist = pg;
+    _slab_init(a, pg, size, tag);
+
+    return pg;
+}
+
+void
+_slab_init(struct _smalloc_arena* a, struct _smalloc_pagegroup_t* pg,
+    size_t size, unsigned tag)
+{
+    struct _smalloc_pagegroup_t** head;
+    size_t avail, nwords, i;
+    uint64_t* bitmap;
+
+    /*
+    * Size the bitmap for as many slots as would fit with no bitmap at
+    * all, then fit as many slots as we can in what's left.  The bitmap
+    * is padded like the header, so the slots start on a line of their
+    * own.  The slab's fields share their space with those of chunk
+    * groups, which this overwrites.
+    */
+    avail = _SMALLOC_PGLEN(pg);
+    nwords = (avail / size + 63) / 64;
+    pg->kind = _SMALLOC_PG_SLAB;
+    pg->tag = tag;
+    pg->slotsize = size;
+    bitmap = _SMALLOC_BITMAP(pg);
+    pg->slots = _SMALLOC_PGHDR_SIZE + _SMALLOC_HDRROUND(nwords * 8);
+    pg->nslots = (avail - (pg->slots - _SMALLOC_PGHDR_SIZE)) / size;
+    pg->hint = 0;
+
+    for (i = 0; i < pg->nslots / 64; i++) {
+        bitmap[i] = ~(uint64_t)0;
+    }
+    if (pg->nslots % 64) {
+        bitmap[i++] = ((uint64_t)1 << (pg->nslots % 64)) - 1;
+    }
+    for (; i < nwords; i++) {
+        bitmap[i] = 0;
+    }
+
+    head = &a->slabs[size / SMALLOC_ALIGNMENT - 1];
+    pg->arena = a;
+    pg->slabnext = *head;
+    *head = pg;
+    _pagemap_set(pg, pg);
+}
+
+void
+_slab_retire(struct _smalloc_pagegroup_t** link)
+{
+    struct _smalloc_pagegroup_t* pg = *link;
+
+    *link = pg->slabnext;
+    _pagemap_set(pg, NULL);
+    pg->kind = _SMALLOC_PG_POOL;
+    pg->hint = (uint32_t)_pool_now() | 1;
+    _pool_add(_pool.npages, pg->npages);
+    _pool_add(_pool.ndirty, pg->npages);
+    _pool_put(pg, pg);
+}
+
+void
+_pool_put(struct _smalloc_pagegroup_t* first,
+    struct _smalloc_pagegroup_t* last)
+{
+    uintptr_t old, new;
+
+    old = _atomic_load(&_pool.head, __ATOMIC_RELAXED);
+    do {
+        last->slabnext =
+            (struct _smalloc_pagegroup_t*)(old & ~_SMALLOC_POOL_TAG);
+        new = (uintptr_t)first | ((old + 1) & _SMALLOC_POOL_TAG);
+    } while (!_pool_cas(old, new));
+}
+
+struct _smalloc_pagegroup_t*
+_pool_get(void)
+{
+    struct _smalloc_pagegroup_t* pg;
+    uintptr_t old, new;
+
+    old = _atomic_load(&_pool.head, __ATOMIC_ACQUIRE);
+    do {
+        pg = (struct _smalloc_pagegroup_t*)(old & ~_SMALLOC_POOL_TAG);
+        if (pg == NULL) {
+            return NULL;
+        }
+        new = (uintptr_t)pg->slabnext | ((old + 1) & _SMALLOC_POOL_TAG);
+    } while (!_pool_cas(old, new));
+
+    _pool_add(_pool.npages, -(size_t)pg->npages);
+    if (pg->hint) {
+        _pool_add(_pool.ndirty, -(size_t)pg->npages);
+    }
+
+    return pg;
+}
+
+unsigned long long
+_pool_now(void)
+{
+#ifdef _WIN32
+    return GetTickCount64();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+#endif
+}
+
+void
+_pool_decay(unsigned long long now)
+{
+    struct _smalloc_pagegroup_t** link;
+    struct _smalloc_pagegroup_t* list;
+    struct _smalloc_pagegroup_t* last;
+    struct _smalloc_pagegroup_t* pg;
+    struct _smalloc_arena* a;
+    uintptr_t old;
+    size_t i, c, npurged, pages;
+
+    _pool.next = now + _pool.decay_ms / 4;
+
+    /*
+    * A class keeps its last slab when it empties; take those too, so
+    * memory doesn't stay with a class the program has stopped using.
+    */
+    for (i = 0; i < SMALLOC_MAX_ARENAS; i++) {
+        a = &_arenas.arena[i];
+        _lock_acquire(&a->lock);
+        for (c = 0; c < _SMALLOC_NSLABCLASSES; c++) {
+            link = &a->slabs[c];
+            while (*link) {
+                if ((*link)->nlive == 0) {
+                    _slab_retire(link);
+                } else {
+                    link = &(*link)->slabnext;
+                }
+            }
+        }
+        _lock_release(&a->lock);
+    }
+
+    /* Take the whole pool, so nobody pops a group while it is purged. */
+    old = _atomic_load(&_pool.head, __ATOMIC_ACQUIRE);
+    do {
+        list = (struct _smalloc_pagegroup_t*)(old & ~_SMALLOC_POOL_TAG);
+    } while (list && !_pool_cas(old, (old + 1) & _SMALLOC_POOL_TAG));
+    if (list == NULL) {
+        return;
+    }
+
+    npurged = pages = 0;
+    for (pg = list; pg; pg = pg->slabnext) {
+        last = pg;
+        if (pg->hint == 0 ||
+            (uint32_t)((uint32_t)now - pg->hint) <
+            _pool.decay_ms) {
+            continue;
+        }
+#ifndef _WIN32
+        /* The first page holds the header, which keeps the pool linked. */
+        _region_purge((char*)pg + _info.pagesize,
+            (pg->npages - 1) * _info.pagesize);
+#endif
+        pg->hint = 0;
+        npurged++;
+        pages += pg->npages;
+    }
+    _pool_add(_pool.ndirty, -pages);
+    _pool_put(list, last);
+
+    if (npurged) {
+        _stats_begin();
+        _info.stats.npurged += npurged;
+        _info.stats.bytes_purged += pages * _info.pagesize;
+        _stats_end();
+    }
+}
+
+void
+_pool_tick(void)
+{
+    unsigned long long now;
+
+    now = _pool_now();
+    if (now < _pool.next) {
+        return;
+    }
+    _smalloc_lock();
+    _pool_decay(now);
+    _smalloc_unlock();
+}
+
+struct _smalloc_arena*
+_slab_lock(struct _smalloc_pagegroup_t* pg)
+{
+    struct _smalloc_arena* a;
+
+    for (;;) {
+        a = pg->arena;
+        _lock_acquire(&a->lock);
+        if (pg->arena == a) {
+            return a;
+        }
+        _lock_release(&a->lock);
+    }
+}
+
+size_t
+_slab_take(struct _smalloc_pagegroup_t* pg, void** out, size_t count)
+{
+    size_t nwords = (pg->nslots + 63) / 64;
+    uint64_t* bitmap = _SMALLOC_BITMAP(pg);
+    char* slots = _SMALLOC_SLOTS(pg);
+    size_t w, n;
+    uint64_t word;
+    int bit;
+
+    n = 0;
+    w = pg->hint;
+    while (n < count) {
+        w = _info.scan(bitmap, nwords, w);
+        if (w == nwords) {
+            break;
+        }
+
+        word = bitmap[w];
+        if ((size_t)__builtin_popcountll(word) <= count - n) {
+            bitmap[w] = 0;
+        } else {
+            /* Only part of this word is needed; keep the rest free. */
+            while (n < count) {
+                bit = __builtin_ctzll(word);
+                bitmap[w] &= ~((uint64_t)1 << bit);
+                word &= word - 1;
+                out[n++] = slots + (w * 64 + bit) * pg->slotsize;
+            }
+            break;
+        }
+
+        while (word) {
+            bit = __builtin_ctzll(word);
+            word &= word - 1;
+            out[n++] = slots + (w * 64 + bit) * pg->slotsize;
+        }
+    }
+
+    pg->hint = w;
+    pg->nlive += n;
+    _arena_stats_alloc(pg, pg->slotsize, n);
+
+    return n;
+}
+
+int
+_slab_give(struct _smalloc_pagegroup_t* pg, void* ptr)
+{
+    struct _smalloc_pagegroup_t** link;
+    uint64_t* bitmap = _SMALLOC_BITMAP(pg);
+    char* slots = _SMALLOC_SLOTS(pg);
+    size_t idx, w;
+    uint64_t bit;
+
+    idx = ((char*)ptr - slots) / pg->slotsize;
+    w = idx / 64;
+    bit = (uint64_t)1 << (idx % 64);
+
+    if ((char*)ptr < slots || idx >= pg->nslots ||
+        slots + idx * pg->slotsize != (char*)ptr) {
+#ifdef SMALLOC_DEBUG
+        fprintf(stderr, "ERROR: sfree: %p is not the start of a slot.\n",
+            ptr);
+#endif
+        return 0;
+    }
+    if (bitmap[w] & bit) {
+#ifdef SMALLOC_DEBUG
+        fprintf(stderr, "ERROR: sfree: double free of %p.\n", ptr);
+#endif
+        return 0;
+    }
+
+    bitmap[w] |= bit;
+    pg->nlive--;
+    if (w < pg->hint) {
+        pg->hint = w;
+    }
+    _arena_stats_free(pg, pg->slotsize);
+
+    /*
+    * An empty slab is free for any class to take, but a class keeps its
+    * last one so that freeing and allocating a single object over and
+    * over doesn't send a slab through the pool every time.
+    */
+    if (pg->nlive) {
+        return 0;
+    }
+    link = &pg->arena->slabs[pg->slotsize / SMALLOC_ALIGNMENT - 1];
+    if (*link == pg && pg->slabnext == NULL) {
+        return 0;
+    }
+    while (*link != pg) {
+        link = &(*link)->slabnext;
+    }
+    _slab_retire(link);
+
+    return 1;
+}
+
+#ifdef _SMALLOC_THREADS
+static pthread_key_t _arena_key;
+static pthread_once_t _arena_once = PTHREAD_ONCE_INIT;
+
+/* Unmaps an exiting thread from its arena. */
+static void
+_arena_exit(void* arg)
+{
+    __sync_fetch_and_sub(&((struct _smalloc_arena*)arg)->nthreads, 1);
+    _self.arena = NULL;
+}
+
+static void
+_arena_key_init(void)
+{
+    pthread_key_create(&_arena_key, _arena_exit);
+}
+#endif
+
+struct _smalloc_arena*
+_arena_get(void)
+{
+#ifdef SMALLOC_SINGLE_THREADED
+    return &_arenas.arena[0];
+#else
+    struct _smalloc_arena* a;
+    unsigned i, n;
+
+    if (_self.arena && _self.epoch == _arenas.epoch) {
+        return _self.arena;
+    }
+
+    if (_self.arena) {
+        __sync_fetch_and_sub(&_self.arena->nthreads, 1);
+    }
+    _self.epoch = _atomic_load(&_arenas.epoch, __ATOMIC_ACQUIRE);
+    n = _atomic_load(&_arenas.narenas, __ATOMIC_ACQUIRE);
+
+    a = &_arenas.arena[0];
+    for (i = 1; i < n; i++) {
+        if (_arenas.arena[i].nthreads < a->nthreads) {
+            a = &_arenas.arena[i];
+        }
+    }
+    __sync_fetch_and_add(&a->nthreads, 1);
+    _self.arena = a;
+
+#ifdef _SMALLOC_THREADS
+    pthread_once(&_arena_once, _arena_key_init);
+    pthread_setspecific(_arena_key, a);
+#endif
+
+    return a;
+#endif
+}
+
+size_t
+_arena_take(size_t size, unsigned tag, void** out, size_t count)
+{
+    struct _smalloc_arena* a;
+    struct _smalloc_pagegroup_t* pg;
+    size_t n;
+
+    /* The arena may have been dropped while this thread waited on it. */
+    for (;;) {
+        a = _arena_get();
+        _lock_acquire(&a->lock);
+        if ((unsigned)(a - _arenas.arena) <
+            _atomic_load(&_arenas.narenas, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        _lock_release(&a->lock);
+    }
+
+    n = 0;
+    while (n < count) {
+        pg = _slab_find(a, size, tag);
+        if (pg == NULL && (pg = _pool_get()) != NULL) {
+            _slab_init(a, pg, size, tag);
+        }
+        if (pg == NULL) {
+            /*
+            * Adding a slab needs the heap lock, which comes first.  Look
+            * again once both are held, as another thread may have added
+            * one in between or the thread been moved to another arena.
+            */
+            _lock_release(&a->lock);
+            _smalloc_lock();
+            if (!_info.ready && _smalloc_init()) {
+                _smalloc_unlock();
+                return n;
+            }
+            a = _arena_get();
+            _lock_acquire(&a->lock);
+            pg = _slab_find(a, size, tag);
+            if (pg == NULL) {
+                pg = _slab_new(a, size, tag);
+            }
+            _smalloc_unlock();
+            if (pg == NULL) {
+                break;
+            }
+        }
+        n += _slab_take(pg, &out[n], count - n);
+    }
+
+    _lock_release(&a->lock);
+
+#ifndef SMALLOC_SINGLE_THREADED
+    _self.ops += n;
+    if (_self.ops >= SMALLOC_ARENA_INTERVAL) {
+        _self.ops = 0;
+        _arena_adapt();
+    }
+#endif
+
+    return n;
+}
+
+#ifndef SMALLOC_SINGLE_THREADED
+void
+_arena_adapt(void)
+{
+    struct _smalloc_arena* a;
+    unsigned long long acq, con, dacq, dcon;
+    size_t nthreads;
+    unsigned i, n, want;
+
+    if (_arenas.fixed || __sync_lock_test_and_set(&_arenas.adapting, 1)) {
+        return;
+    }
+
+    acq = con = 0;
+    nthreads = 0;
+    for (i = 0; i < SMALLOC_MAX_ARENAS; i++) {
+        a = &_arenas.arena[i];
+        acq += a->lock.stats.acquisitions;
+        con += a->lock.stats.contended;
+        nthreads += a->nthreads;
+    }
+    dacq = acq - _arenas.acquisitions;
+    dcon = con - _arenas.contended;
+    _arenas.acquisitions = acq;
+    _arenas.contended = con;
+
+    n = _arenas.narenas;
+    want = n;
+    if (dcon * 1000 > dacq * SMALLOC_ARENA_GROW) {
+        _arenas.quiet = 0;
+        want = n * 2;
+        if (want > SMALLOC_MAX_ARENAS) {
+            want = SMALLOC_MAX_ARENAS;
+        }
+        if (want > nthreads) {
+            want = nthreads > n ? nthreads : n;
+        }
+    } else if (dcon * 1000 <= dacq * SMALLOC_ARENA_SHRINK) {
+        if (n > 1 && ++_arenas.quiet >= SMALLOC_ARENA_QUIET) {
+            _arenas.quiet = 0;
+            want = n / 2;
+        }
+    } else {
+        _arenas.quiet = 0;
+    }
+
+    if (want != n && !_arenas.fixed) {
+        _arena_resize(want);
+    }
+
+    __sync_lock_release(&_arenas.adapting);
+}
+
+void
+_arena_resize(unsigned n)
+{
+    struct _smalloc_arena* from;
+    struct _smalloc_arena* to;
+    unsigned i, old;
+
+    _smalloc_lock();
+
+    /*
+    * Drop the arenas before moving their slabs.  A thread that locks a
+    * dropped arena from here on sees that it was dropped and picks again
+    * (see _arena_take), and one that locked it before holds it until
+    * whatever slab it adds there has been moved along with the rest.
+    */
+    old = _arenas.narenas;
+    _atomic_store(&_arenas.narenas, n, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&_arenas.epoch, 1, __ATOMIC_RELEASE);
+
+    /*
+    * Frees look up a slab's arena before taking its lock and check it
+    * again after, so a slab can move while both arenas are locked.
+    */
+    for (i = n; i < old; i++) {
+        from = &_arenas.arena[i];
+        to = &_arenas.arena[i % n];
+        _lock_acquire(&from->lock);
+        _lock_acquire(&to->lock);
+        _arena_merge(from, to);
+        _lock_release(&to->lock);
+        _lock_release(&from->lock);
+    }
+
+    _smalloc_unlock();
+}
+#endif
+
+void
+_arena_merge(struct _smalloc_arena* from, struct _smalloc_arena* to)
+{
+    struct _smalloc_pagegroup_t* pg;
+    unsigned c;
+
+    for (c = 0; c < _SMALLOC_NSLABCLASSES; c++) {
+        while ((pg = from->slabs[c]) != NULL) {
+            from->slabs[c] = pg->slabnext;
+            pg->slabnext = to->slabs[c];
+            to->slabs[c] = pg;
+            pg->arena = to;
+        }
+    }
+}
+
+void
+_pagemap_set(struct _smalloc_pagegroup_t* pg, struct _smalloc_pagegroup_t* val)
+{
+#ifndef _WIN32
+    struct _smalloc_pagegroup_t** leaf;
+    uintptr_t key, end;
+    void* map;
+
+    key = (uintptr_t)pg >> _SMALLOC_PAGEMAP_SHIFT;
+    end = ((uintptr_t)pg + pg->npages * _info.pagesize) >>
+        _SMALLOC_PAGEMAP_SHIFT;
+    if ((end - 1) >> (2 * _SMALLOC_PAGEMAP_BITS)) {
+        return;
+    }
+
+    if (_info.pagemap == NULL) {
+        map = mmap(NULL, _SMALLOC_PAGEMAP_LEN * sizeof(void*),
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS |
+            MAP_NORESERVE, -1, 0);
+        if (map == MAP_FAILED) {
+            return;
+        }
+        _atomic_store(&_info.pagemap, map, __ATOMIC_RELEASE);
+    }
+
+    for (; key < end; key++) {
+        leaf = _info.pagemap[key >> _SMALLOC_PAGEMAP_BITS];
+        if (leaf == NULL) {
+            if (val == NULL) {
+                continue;
+            }
+            map = mmap(NULL, _SMALLOC_PAGEMAP_LEN * sizeof(void*),
+                PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS |
+                MAP_NORESERVE, -1, 0);
+            if (map == MAP_FAILED) {
+                return;
+            }
+            leaf = map;
+            _atomic_store(&_info.pagemap[key >> _SMALLOC_PAGEMAP_BITS],
+                leaf, __ATOMIC_RELEASE);
+        }
+        _atomic_store(&leaf[key & (_SMALLOC_PAGEMAP_LEN - 1)], val,
+            __ATOMIC_RELEASE);
+    }
+#endif
+}
+
+struct _smalloc_pagegroup_t*
+_pagemap_get(void* ptr)
+{
+#ifdef _WIN32
+    return NULL;
+#else
+    struct _smalloc_pagegroup_t** volatile* root;
+    struct _smalloc_pagegroup_t** leaf;
+    uintptr_t key;
+
+    key = (uintptr_t)ptr >> _SMALLOC_PAGEMAP_SHIFT;
+    root = _atomic_load(&_info.pagemap, __ATOMIC_ACQUIRE);
+    if (root == NULL || key >> (2 * _SMALLOC_PAGEMAP_BITS)) {
+        return NULL;
+    }
+    leaf = _atomic_load(&root[key >> _SMALLOC_PAGEMAP_BITS],
+        __ATOMIC_ACQUIRE);
+    if (leaf == NULL) {
+        return NULL;
+    }
+
+    return _atomic_load(&leaf[key & (_SMALLOC_PAGEMAP_LEN - 1)],
+        __ATOMIC_ACQUIRE);
+#endif
+}
+
+void
+_pagemap_slabs(struct _smalloc_pagegroup_t* list, int set)
+{
+    for (; list; list = list->next) {
+        if (list->kind == _SMALLOC_PG_SLAB) {
+            _pagemap_set(list, set ? list : NULL);
+        }
+    }
+}
+
+void
+_pagemap_heaps(int set)
+{
+    struct smalloc_stack* st;
+    struct _smalloc_pagegroup_t* pg;
+
+    for (st = _info.heaps; st; st = st->nextheap) {
+        for (pg = st->first; pg; pg = pg->next) {
+            _pagemap_set(pg, set ? pg : NULL);
+        }
+    }
+}
+
+#ifndef SMALLOC_SINGLE_THREADED
+static void
+_lock_pause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static unsigned long long
+_lock_clock(void)
+{
+#ifdef _WIN32
+    return (unsigned long long)GetTickCount64() * 1000000ULL;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static void
+_lock_sleep(volatile int* state, int value)
+{
+#if defined(__linux__)
+    syscall(SYS_futex, state, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+#elif defined(_WIN32)
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+static void
+_lock_wake(volatile int* state)
+{
+#if defined(__linux__)
+    syscall(SYS_futex, state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+}
+
+void
+_lock_acquire(struct _smalloc_lock_t* lk)
+{
+    unsigned long long start;
+    int i;
+
+    if (__sync_bool_compare_and_swap(&lk->state, 0, 1)) {
+        lk->stats.acquisitions++;
+        return;
+    }
+
+    start = _lock_clock();
+    for (i = 0; i < SMALLOC_LOCK_SPINS; i++) {
+        _lock_pause();
+        if (lk->state == 0 && __sync_bool_compare_and_swap(&lk->state, 0, 1)) {
+            goto acquired;
+        }
+    }
+
+    /*
+    * Mark the lock as having sleepers before going to sleep so the
+    * holder knows it has to wake somebody up when it lets go.
+    */
+    while (__sync_lock_test_and_set(&lk->state, 2) != 0) {
+        _lock_sleep(&lk->state, 2);
+    }
+
+acquired:
+    lk->stats.acquisitions++;
+    lk->stats.contended++;
+    lk->stats.wait_ns += _lock_clock() - start;
+}
+
+void
+_lock_release(struct _smalloc_lock_t* lk)
+{
+    if (__sync_lock_test_and_set(&lk->state, 0) == 2) {
+        _lock_wake(&lk->state);
+    }
+}
+#endif
+
+#ifndef _WIN32
+void
+_fork_prepare(void)
+{
+    size_t i;
+
+    _smalloc_lock();
+    for (i = 0; i < SMALLOC_MAX_ARENAS; i++) {
+        _lock_acquire(&_arenas.arena[i].lock);
+    }
+}
+
+void
+_fork_parent(void)
+{
+    size_t i;
+
+    for (i = SMALLOC_MAX_ARENAS; i-- > 0;) {
+        _lock_release(&_arenas.arena[i].lock);
+    }
+    _smalloc_unlock();
+}
+
+void
+_fork_child(void)
+{
+#ifdef _SMALLOC_THREADS
+    struct _coro_cache* c;
+    void* list;
+    void* next;
+#endif
+    size_t i;
+
+    /* The forking thread is the only one left, mapped to its arena. */
+    for (i = 0; i < SMALLOC_MAX_ARENAS; i++) {
+        _arenas.arena[i].lock.state = 0;
+        _arenas.arena[i].nthreads = 0;
+    }
+    if (_self.arena) {
+        _self.arena->nthreads = 1;
+    }
+    _arenas.adapting = 0;
+
+#ifdef _SMALLOC_THREADS
+    /*
+    * Chunks queued for the parent's reclaimer are still queued in our
+    * copy of the heap; free them here since no reclaimer runs yet.
+    * Anything the parent's reclaimer had already taken off the queue
+    * is lost to the child.
+    */
+    list = _reclaim.head;
+    _reclaim.head = NULL;
+    _reclaim.pending = 0;
+    while (list) {
+        next = *(void**)list;
+        _smalloc_free_locked(list);
+        list = next;
+    }
+
+    _reclaim.started = 0;
+    _reclaim.tick = 0;
+    _reclaim.prefault = 0;
+    pthread_mutex_init(&_reclaim.lock, NULL);
+    pthread_cond_init(&_reclaim.wake, NULL);
+    _shm.seg = NULL;
+#endif
+
+    /*
+    * Regions mapped MAP_SHARED from a memfd would still be shared with
+    * the parent; give the child copies of its own.
+    */
+    for (i = 0; i < _info.nmemfds; i++) {
+        if (!_info.memfds[i].private) {
+            _memfd_rewrite(&_info.memfds[i]);
+        }
+    }
+
+    if (_info.fork_policy == SMALLOC_FORK_FRESH &&
+        (_info.pglist || _info.slablist)) {
+        _pagemap_slabs(_info.slablist, 0);
+        _pgroup_append(&_info.inherited, _info.pglist);
+        _pgroup_append(&_info.inherited, _info.slablist);
+        _info.pglist = NULL;
+        _info.slablist = NULL;
+        for (i = 0; i < SMALLOC_MAX_ARENAS; i++) {
+            memset(_arenas.arena[i].slabs, 0,
+                sizeof(_arenas.arena[i].slabs));
+        }
+        _pool.head = 0;
+        _pool.npages = 0;
+        _pool.ndirty = 0;
+    }
+
+    /* The forking thread is the only one left and it owns the lock. */
+    _info.lock.state = 0;
+
+#ifdef _SMALLOC_THREADS
+    /*
+    * Coroutine caches of the threads that weren't copied will never be
+    * retired by their owners.  Caches only ever go on the front of the
+    * list, so retiring them while walking it is safe.
+    */
+    for (c = _coro_all; c; c = c->all) {
+        if (c != _coro && c->remote != _CORO_RETIRED) {
+            _coro_retire(c);
+        }
+    }
+#endif
+}
+#endif
+
+#ifndef SMALLOC_SINGLE_THREADED
+void
+_smalloc_lock(void)
+{
+    _lock_acquire(&_info.lock);
+}
+
+void
+_smalloc_unlock(void)
+{
+    _lock_release(&_info.lock);
+}
+#endif
+
+int
+_smalloc_free_locked(void* ptr)
+{
+    struct _smalloc_chunk_t* chk;
+    struct _smalloc_pagegroup_t* pg;
+    struct _smalloc_arena* a;
+
+    pg = _pgroup_owner(ptr);
+    if (pg == NULL) {
+        if (_pgroup_find(_info.inherited, ptr)) {
+            return 0;
+        }
+#ifdef SMALLOC_DEBUG
+        fprintf(stderr, "ERROR: sfree: %p was not allocated by "
+            "smalloc.\n", ptr);
+#endif
+        return 0;
+    }
+
+    if (pg->kind == _SMALLOC_PG_STACK) {
+        return 0;
+    }
+    if (pg->kind == _SMALLOC_PG_SLAB || pg->kind == _SMALLOC_PG_POOL) {
+        a = _slab_lock(pg);
+        /* Unless every slot was freed already and it went to the pool. */
+        if (pg->kind == _SMALLOC_PG_SLAB) {
+            _slab_give(pg, ptr);
+        }
+        _lock_release(&a->lock);
+        return 0;
+    }
+
+    chk = (struct _smalloc_chunk_t*)((char*)ptr - _SMALLOC_CHKHDR_SIZE);
+    if (chk->freed) {
+#ifdef SMALLOC_DEBUG
+        fprintf(stderr, "ERROR: sfree: double free of %p.\n", ptr);
+#endif
+        return 0;
+    }
+    chk->freed = 1;
+    _stats_free(pg, chk->len);
+
+    /*
+    * Chunks are bump allocated, so the space can only be handed out
+    * again once every chunk in the group has been freed.
+    */
+    if (--pg->nlive == 0) {
+        pg->top = (char*)pg + _SMALLOC_PGHDR_SIZE;
+        pg->bytesfree = _SMALLOC_PGLEN(pg);
+#ifndef SMALLOC_COMPACT
+        pg->chunks = NULL;
+#endif
+        return pg->npages > SMALLOC_SMALLEST_PAGE_GROUP;
+    }
+
+    return 0;
+}
+
+#ifdef _SMALLOC_THREADS
+void
+_reclaim_push(void* first, void* last, size_t count)
+{
+    void* old;
+
+    __sync_fetch_and_add(&_reclaim.pending, count);
+
+    do {
+        old = _reclaim.head;
+        *(void**)last = old;
+    } while (!__sync_bool_compare_and_swap(&_reclaim.head, old, first));
+
+    /*
+    * Start the reclaimer the first time anybody needs it.  If it can't
+    * be created, the caller frees its own chunks rather than leak them.
+    */
+    if (_reclaim_start()) {
+        sfree_async_flush();
+        return;
+    }
+
+    /*
+    * The reclaimer always empties the whole stack, so it can only be
+    * asleep if we just pushed onto an empty one.
+    */
+    if (old == NULL) {
+        _reclaim_wake();
+    }
+}
+
+void
+_reclaim_wake(void)
+{
+    pthread_mutex_lock(&_reclaim.lock);
+    pthread_cond_signal(&_reclaim.wake);
+    pthread_mutex_unlock(&_reclaim.lock);
+}
+
+void
+_reclaim_batch(void* list)
+{
+    void* next;
+    size_t n;
+    int release;
+
+    n = 0;
+    release = 0;
+
+    _smalloc_lock();
+    while (list) {
+        next = *(void**)list;
+        release |= _smalloc_free_locked(list);
+        list = next;
+        n++;
+    }
+    if (release) {
+        _pgroup_cleanup(_info.pglist);
+    }
+    _smalloc_unlock();
+
+    __sync_fetch_and_sub(&_reclaim.pending, n);
+}
+
+int
+_reclaim_start(void)
+{
+    if (_reclaim.started ||
+        !__sync_bool_compare_and_swap(&_reclaim.started, 0, 1)) {
+        return 0;
+    }
+
+    if (pthread_create(&_reclaim.thread, NULL, _reclaim_main, NULL)) {
+#ifdef SMALLOC_DEBUG
+        fprintf(stderr, "ERROR: _reclaim_start: Failed to start the "
+            "reclaimer thread.\n");
+#endif
+        _reclaim.started = 0;
+        return -1;
+    }
+    pthread_detach(_reclaim.thread);
+
+    return 0;
+}
+
+void*
+_reclaim_main(void* arg)
+{
+    void* list;
+    struct timespec ts;
+    unsigned tick;
+
+    for (;;) {
+        pthread_mutex_lock(&_reclaim.lock);
+        while (_reclaim.head == NULL && !_reclaim.prefault) {
+            tick = _reclaim.tick;
+            if (tick == 0) {
+                pthread_cond_wait(&_reclaim.wake, &_reclaim.lock);
+                continue;
+            }
+
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += tick / 1000;
+            ts.tv_nsec += (tick % 1000) * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            if (pthread_cond_timedwait(&_reclaim.wake, &_reclaim.lock,
+                &ts)) {
+                break;
+            }
+        }
+        pthread_mutex_unlock(&_reclaim.lock);
+
+        list = __sync_lock_test_and_set(&_reclaim.head, NULL);
+        if (list) {
+            _reclaim_batch(list);
+        }
+
+        if (_reclaim.prefault) {
+            _prefault_run();
+        }
+
+        if (_shm.seg) {
+            _shm_publish();
+        }
+    }
+
+    return NULL;
+}
+
+void
+_prefault_request(void)
+{
+    if (_reclaim.prefault) {
+        return;
+    }
+    _reclaim.prefault = 1;
+    if (_reclaim_start() == 0) {
+        _reclaim_wake();
+    }
+}
+
+void
+_prefault_run(void)
+{
+    struct {
+        char* start;
+        size_t len;
+    } ranges[_SMALLOC_PREFAULT_RANGES];
+    struct _smalloc_pagegroup_t* pg;
+    size_t window, pages;
+    char* target;
+    char* end;
+    int i, n, release;
+
+    _reclaim.prefault = 0;
+
+    /*
+    * Work out the ranges under the heap lock, but populate them after
+    * letting go of it so allocating threads never wait on the faults.
+    * The groups stay pinned until then, so none of them can be released
+    * and its pages purged or handed to someone else in between.
+    */
+    _smalloc_lock();
+    window = _info.prefault_pages * _info.pagesize;
+    pages = 0;
+    n = 0;
+    for (pg = _info.pglist; pg && window; pg = pg->next) {
+        if (n == sizeof(ranges) / sizeof(ranges[0])) {
+            _reclaim.prefault = 1;
+            break;
+        }
+
+        end = (char*)pg + pg->npages * _info.pagesize;
+        target = (char*)(((uintptr_t)pg->top + window + _info.pagesize - 1) &
+            ~(uintptr_t)(_info.pagesize - 1));
+        if (target > end) {
+            target = end;
+        }
+        if (target > (char*)pg + pg->prefaulted) {
+            ranges[n].start = (char*)pg + pg->prefaulted;
+            ranges[n].len = target - ranges[n].start;
+            pages += ranges[n].len / _info.pagesize;
+            pg->prefaulted = target - (char*)pg;
+            _reclaim.pinned[n] = pg;
+            n++;
+        }
+    }
+    _reclaim.npinned = n;
+    if (pages) {
+        _stats_begin();
+        _info.stats.pages_prefaulted += pages;
+        _stats_end();
+    }
+    _smalloc_unlock();
+
+    if (n == 0) {
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        madvise(ranges[i].start, ranges[i].len, MADV_POPULATE_WRITE);
+    }
+
+    /* Release whatever emptied out while it was pinned. */
+    _smalloc_lock();
+    release = 0;
+    for (i = 0; i < n; i++) {
+        release |= _reclaim.pinned[i]->nlive == 0;
+    }
+    _reclaim.npinned = 0;
+    if (release) {
+        _pgroup_cleanup(_info.pglist);
+    }
+    _smalloc_unlock();
+}
+
+int
+_prefault_pinned(struct _smalloc_pagegroup_t* pg)
+{
+    int i;
+
+    for (i = 0; i < _reclaim.npinned; i++) {
+        if (_reclaim.pinned[i] == pg) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+* Reads the resident set size of the process, in bytes, or returns 0 if
+* the OS doesn't expose it through /proc.
+*/
+static size_t
+_shm_rss(void)
+{
+    char buf[128];
+    char* p;
+    ssize_t n;
+    int fd;
+
+    fd = open("/proc/self/statm", O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) {
+        return 0;
+    }
+    buf[n] = '\0';
+
+    /* The second field is the number of resident pages. */
+    p = strchr(buf, ' ');
+    if (p == NULL) {
+        return 0;
+    }
+
+    return strtoul(p + 1, NULL, 10) * _info.pagesize;
+}
+
+void
+_shm_publish(void)
+{
+    struct smalloc_shm_segment* seg = _shm.seg;
+    struct smalloc_stats st;
+    struct timespec ts;
+    size_t rss;
+
+    smalloc_stats(&st);
+    rss = _shm_rss();
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    /* Same sequence lock protocol as '_info.stats', across processes. */
+    seg->seq++;
+    _atomic_fence(__ATOMIC_RELEASE);
+    seg->timestamp_ns = (unsigned long long)ts.tv_sec * 1000000000ULL +
+        ts.tv_nsec;
+    seg->rss_bytes = rss;
+    seg->stats = st;
+    _atomic_store(&seg->seq, seg->seq + 1, __ATOMIC_RELEASE);
+}
+#endif
+
+struct _smalloc_pagegroup_t*
 _pages_alloc(size_t size, size_t pcount)
 {
-    void* ret = NULL;
-    size_t len = pcount * _info.pagesize;
-    size_t adjusted;
-    size_t npages;
-    struct _smalloc_pagegroup_t* pg;
+    void* ret = NULL;
+    size_t len = pcount * _info.pagesize;
+    size_t adjusted;
+    size_t npages;
+    struct _smalloc_pagegroup_t* pg;
+
+    /* Sizes this close to the limit would wrap the sums below. */
+    if (size > (size_t)-1 - _SMALLOC_PGHDR_SIZE - _SMALLOC_CHKHDR_SIZE -
+        _info.pagesize) {
+        return NULL;
+    }
+
+    /*
+    * 'adjusted' is how much memory will actually
+    * be required to fulfill the size request.
+    */
+    adjusted = size + _SMALLOC_PGHDR_SIZE + _SMALLOC_CHKHDR_SIZE;
+
+    /*
+    * If the page count requested will fit all of
+    * the adjusted size, no need to do more math.
+    *
+    * Otherwise, we need to figure out how many
+    * pages it will take to fit all of size.
+    */
+    npages = 0;
+    if (pcount * _info.pagesize >= adjusted) {
+        len = pcount * _info.pagesize;
+        npages = pcount;
+    } else {
+        len = _info.pagesize * (adjusted / _info.pagesize);
+        len += _info.pagesize;
+        npages = len / _info.pagesize;
+    }
+
+#ifdef SMALLOC_DEBUG
+    if (len % _info.pagesize != 0) {
+        fprintf(stderr, "ERROR: _pages_alloc: attempting improper page "
+            "alignment for mmap(2)\n");
+    }
+#endif
+
+    ret = _extent_alloc(&npages);
+    len = npages * _info.pagesize;
+
+#ifdef SMALLOC_DEBUG
+    fprintf(stdout, "INFO: _pgroup_alloc: requested %lu bytes, %lu pages\n",
+        len, len / _info.pagesize);
+#endif
+    if (!ret) {
+#ifdef SMALLOC_DEBUG
+        fprintf(stderr, "ERROR: failed to allocate page group.\n");
+#endif
+        return NULL;
+    }
+    if (len > _SMALLOC_SIZE_MAX || npages > UINT32_MAX) {
+        /* Too big for the header's fields. */
+        _extent_free(ret, npages);
+        return NULL;
+    }
+
+    pg = (struct _smalloc_pagegroup_t*)ret;
+    pg->top = ret + _SMALLOC_PGHDR_SIZE;
+    pg->npages = npages;
+    pg->bytesfree = len - _SMALLOC_PGHDR_SIZE;
+    pg->nlive = 0;
+    pg->tag = 0;
+    pg->kind = _SMALLOC_PG_CHUNKS;
+    pg->hiwater = _SMALLOC_PGHDR_SIZE;
+    pg->prefaulted = _info.pagesize;
+#ifndef SMALLOC_COMPACT
+    pg->chunks = NULL;
+#endif
+    pg->next = NULL;
+
+    _stats_begin();
+    _info.stats.bytes_mapped += len;
+    _info.stats.npagegroups++;
+    _stats_end();
+
+    return pg;
+}
+
+void
+_pages_release(struct _smalloc_pagegroup_t* pg)
+{
+    _stats_begin();
+    _info.stats.bytes_mapped -= pg->npages * _info.pagesize;
+    _info.stats.npagegroups--;
+    _info.stats.npurged++;
+    _info.stats.bytes_purged += pg->npages * _info.pagesize;
+    _stats_end();
+
+    _extent_free(pg, pg->npages);
+}
+
+void*
+_extent_alloc(size_t* npages)
+{
+    void* ret;
+
+#ifdef _WIN32
+    ret = HeapAlloc(_info.heap_ptr, HEAP_ZERO_MEMORY,
+        *npages * _info.pagesize);
+#else
+    ret = NULL;
+    if (_info.backend == SMALLOC_BACKEND_BUDDY) {
+        ret = _buddy_alloc(npages);
+    } else if (_info.backend == SMALLOC_BACKEND_SPAN) {
+        ret = _span_alloc(npages);
+    }
+    if (ret || _info.memfd) {
+        return ret;
+    }
+
+    ret = mmap(0, *npages * _info.pagesize, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0L);
+    if (ret == MAP_FAILED) {
+        ret = NULL;
+    }
+#endif
+
+    return ret;
+}
+
+void*
+_extent_grow(void* ptr, size_t npages, size_t* newpages, int maymove)
+{
+#ifdef _WIN32
+    return NULL;
+#else
+    size_t extra;
+    char* end;
+    void* ret;
+
+    if (_info.backend == SMALLOC_BACKEND_BUDDY) {
+        switch (_buddy_grow(ptr, newpages)) {
+        case 0:
+            return ptr;
+        case -1:
+            return NULL;
+        }
+    } else if (_info.backend == SMALLOC_BACKEND_SPAN) {
+        switch (_span_grow(ptr, newpages)) {
+        case 0:
+            return ptr;
+        case -1:
+            return NULL;
+        }
+    }
+
+    /*
+    * A mapping of its own.  Map the pages right after it, but only if
+    * nothing else lives there; kernels without MAP_FIXED_NOREPLACE
+    * treat the address as a hint and may put the pages elsewhere.
+    */
+    extra = (*newpages - npages) * _info.pagesize;
+    end = (char*)ptr + npages * _info.pagesize;
+    ret = mmap(end, extra, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0L);
+    if (ret == end) {
+        return ptr;
+    }
+    if (ret != MAP_FAILED) {
+        munmap(ret, extra);
+    }
+
+#ifdef __linux__
+    if (maymove) {
+        ret = (void*)syscall(SYS_mremap, ptr, npages * _info.pagesize,
+            *newpages * _info.pagesize, MREMAP_MAYMOVE);
+        if (ret != MAP_FAILED) {
+            return ret;
+        }
+    }
+#endif
+
+    return NULL;
+#endif
+}
+
+void
+_extent_free(void* ptr, size_t npages)
+{
+#ifdef _WIN32
+    HeapFree(_info.heap_ptr, 0, ptr);
+#else
+    if (_info.backend == SMALLOC_BACKEND_BUDDY && _buddy_free(ptr) == 0) {
+        return;
+    }
+    if (_info.backend == SMALLOC_BACKEND_SPAN && _span_free(ptr) == 0) {
+        return;
+    }
+
+    munmap(ptr, npages * _info.pagesize);
+#endif
+}
+
+#ifndef _WIN32
+static int
+_memfd_create(void)
+{
+#ifdef SYS_memfd_create
+    return syscall(SYS_memfd_create, "smalloc", MFD_CLOEXEC);
+#else
+    return -1;
+#endif
+}
+
+char*
+_region_map(size_t len, size_t* metalen, char** meta)
+{
+    struct _memfd_region* m;
+    char* base;
+    int fd;
+
+    *metalen = (*metalen + _info.pagesize - 1) & ~(_info.pagesize - 1);
+    if (!_info.memfd) {
+        base = mmap(0, len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0L);
+        if (base == MAP_FAILED) {
+            return NULL;
+        }
+        *meta = mmap(0, *metalen, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0L);
+        if (*meta == MAP_FAILED) {
+            munmap(base, len);
+            return NULL;
+        }
+        return base;
+    }
+
+    if (_info.nmemfds == _SMALLOC_MAX_MEMFDS) {
+        return NULL;
+    }
+    fd = _memfd_create();
+    if (fd < 0) {
+        return NULL;
+    }
+    if (ftruncate(fd, len + *metalen) == 0) {
+        base = mmap(0, len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_NORESERVE, fd, 0L);
+        if (base != MAP_FAILED) {
+            *meta = mmap(0, *metalen, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                len);
+            if (*meta != MAP_FAILED) {
+                m = &_info.memfds[_info.nmemfds++];
+                m->base = base;
+                m->len = len;
+                m->meta = *meta;
+                m->metalen = *metalen;
+                m->fd = fd;
+                m->private = 0;
+                return base;
+            }
+            munmap(base, len);
+        }
+    }
+    close(fd);
+
+    return NULL;
+}
+
+void
+_region_purge(void* ptr, size_t len)
+{
+    struct _memfd_region* m;
+    size_t i;
+
+    for (i = 0; i < _info.nmemfds; i++) {
+        m = &_info.memfds[i];
+        if ((char*)ptr >= m->base && (char*)ptr < m->base + m->len) {
+            break;
+        }
+    }
+    if (i == _info.nmemfds) {
+        madvise(ptr, len, MADV_DONTNEED);
+        return;
+    }
+
+    /*
+    * Punch the pages out of the file, unless it is holding a snapshot;
+    * then just cover them with fresh zero pages until the next rollback
+    * or commit.
+    */
+    if (m->private) {
+        mmap(ptr, len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0L);
+    } else {
+        madvise(ptr, len, MADV_REMOVE);
+    }
+}
+
+int
+_memfd_remap(struct _memfd_region* m, int private)
+{
+    int flags;
+
+    flags = (private ? MAP_PRIVATE : MAP_SHARED) | MAP_FIXED;
+    if (mmap(m->base, m->len, PROT_READ | PROT_WRITE, flags | MAP_NORESERVE,
+        m->fd, 0L) == MAP_FAILED ||
+        mmap(m->meta, m->metalen, PROT_READ | PROT_WRITE, flags, m->fd,
+        m->len) == MAP_FAILED) {
+        return -1;
+    }
+    m->private = private;
+
+    return 0;
+}
+
+/* Writes all of [ptr, ptr + len) to 'fd' at 'off'. */
+static int
+_memfd_write(int fd, const char* ptr, size_t len, off_t off)
+{
+    ssize_t n;
+
+    while (len) {
+        n = pwrite(fd, ptr, len, off);
+        if (n <= 0) {
+            return -1;
+        }
+        ptr += n;
+        len -= n;
+        off += n;
+    }
+
+    return 0;
+}
+
+int
+_memfd_rewrite(struct _memfd_region* m)
+{
+    struct _buddy_region* br;
+    struct _span_region* sr;
+    size_t idx, n;
+    int fd, used, old;
+
+    fd = _memfd_create();
+    if (fd < 0) {
+        return -1;
+    }
+    if (ftruncate(fd, m->len + m->metalen)) {
+        close(fd);
+        return -1;
+    }
+
+    /* Extents tile the region; only the ones in use need copying. */
+    br = (struct _buddy_region*)m->meta;
+    sr = (struct _span_region*)m->meta;
+    for (idx = 0; idx < m->len / _info.pagesize; idx += n) {
+        if (_info.backend == SMALLOC_BACKEND_BUDDY) {
+            n = (size_t)1 << (br->state[idx] & _BUDDY_ORDER);
+            used = (br->state[idx] & _BUDDY_USED) != 0;
+        } else {
+            n = sr->len[idx];
+            used = sr->state[idx] == _SPAN_USED;
+        }
+        if (used && _memfd_write(fd, m->base + idx * _info.pagesize,
+            n * _info.pagesize, idx * _info.pagesize)) {
+            close(fd);
+            return -1;
+        }
+    }
+    if (_memfd_write(fd, m->meta, m->metalen, m->len)) {
+        close(fd);
+        return -1;
+    }
+
+    old = m->fd;
+    m->fd = fd;
+    if (_memfd_remap(m, 0)) {
+        m->fd = old;
+        close(fd);
+        return -1;
+    }
+    close(old);
+
+    return 0;
+}
+
+static void
+_buddy_push(struct _buddy_region* r, int order, uint32_t idx)
+{
+    r->next[idx] = r->head[order];
+    r->prev[idx] = _BUDDY_NIL;
+    if (r->head[order] != _BUDDY_NIL) {
+        r->prev[r->head[order]] = idx;
+    }
+    r->head[order] = idx;
+    r->state[idx] = _BUDDY_FREE | order;
+}
+
+static void
+_buddy_unlink(struct _buddy_region* r, int order, uint32_t idx)
+{
+    if (r->prev[idx] != _BUDDY_NIL) {
+        r->next[r->prev[idx]] = r->next[idx];
+    } else {
+        r->head[order] = r->next[idx];
+    }
+    if (r->next[idx] != _BUDDY_NIL) {
+        r->prev[r->next[idx]] = r->prev[idx];
+    }
+    r->state[idx] = 0;
+}
+
+static struct _buddy_region*
+_buddy_region_new(void)
+{
+    struct _buddy_region* r;
+    size_t npages, metalen;
+    char* base;
+    char* meta;
+    int order, i;
+
+    npages = SMALLOC_REGION_SIZE / _info.pagesize;
+    for (order = 0; ((size_t)2 << order) <= npages; order++) {
+    }
+    npages = (size_t)1 << order;
+
+    metalen = sizeof(*r) + npages * (2 * sizeof(uint32_t) + 1);
+    base = _region_map(npages * _info.pagesize, &metalen, &meta);
+    if (base == NULL) {
+        return NULL;
+    }
+
+    r = (struct _buddy_region*)meta;
+    r->base = base;
+    r->npages = npages;
+    r->maxorder = order;
+    r->nfree = npages;
+    r->metalen = metalen;
+    r->next = (uint32_t*)(meta + sizeof(*r));
+    r->prev = r->next + npages;
+    r->state = (unsigned char*)(r->prev + npages);
+    r->link = NULL;
+    for (i = 0; i < _BUDDY_MAX_ORDERS; i++) {
+        r->head[i] = _BUDDY_NIL;
+    }
+    _buddy_push(r, order, 0);
+
+    _stats_begin();
+    _info.stats.bytes_reserved += npages * _info.pagesize;
+    _stats_end();
+
+    return r;
+}
+
+void*
+_buddy_alloc(size_t* npages)
+{
+    struct _buddy_region** link;
+    struct _buddy_region* r;
+    uint32_t idx;
+    int order, k;
+
+    for (order = 0; ((size_t)1 << order) < *npages; order++) {
+    }
+
+    for (link = &_info.regions; ; link = &r->link) {
+        r = *link;
+        if (r == NULL) {
+            r = *link = _buddy_region_new();
+            if (r == NULL) {
+                return NULL;
+            }
+        }
+        if (order > r->maxorder) {
+            return NULL;
+        }
+
+        /* Take the smallest free block that fits... */
+        for (k = order; k <= r->maxorder && r->head[k] == _BUDDY_NIL; k++) {
+        }
+        if (k > r->maxorder) {
+            continue;
+        }
+        idx = r->head[k];
+        _buddy_unlink(r, k, idx);
+
+        /* ...and split it, freeing the upper halves, until it's snug. */
+        while (k > order) {
+            k--;
+            _buddy_push(r, k, idx + ((uint32_t)1 << k));
+        }
+        r->state[idx] = _BUDDY_USED | order;
+        r->nfree -= (size_t)1 << order;
+        break;
+    }
+
+    _stats_begin();
+    _buddy_stats();
+    _stats_end();
+
+    *npages = (size_t)1 << order;
+    return r->base + (size_t)idx * _info.pagesize;
+}
+
+int
+_buddy_free(void* ptr)
+{
+    struct _buddy_region* r;
+    uint32_t idx, buddy;
+    int order;
+
+    for (r = _info.regions; r; r = r->link) {
+        if ((char*)ptr >= r->base &&
+            (char*)ptr < r->base + r->npages * _info.pagesize) {
+            break;
+        }
+    }
+    if (r == NULL) {
+        return -1;
+    }
+
+    idx = ((char*)ptr - r->base) / _info.pagesize;
+    order = r->state[idx] & _BUDDY_ORDER;
+
+    /* Hand the memory back but keep the address space reserved. */
+    _region_purge(ptr, ((size_t)1 << order) * _info.pagesize);
+    r->nfree += (size_t)1 << order;
+
+    /* Merge with the buddy for as long as the buddy is free too. */
+    while (order < r->maxorder) {
+        buddy = idx ^ ((uint32_t)1 << order);
+        if (r->state[buddy] != (_BUDDY_FREE | order)) {
+            break;
+        }
+        _buddy_unlink(r, order, buddy);
+        if (buddy < idx) {
+            r->state[idx] = 0;
+            idx = buddy;
+        }
+        order++;
+    }
+    r->state[idx] = 0;
+    _buddy_push(r, order, idx);
+
+    _stats_begin();
+    _buddy_stats();
+    _stats_end();
+
+    return 0;
+}
+
+int
+_buddy_grow(void* ptr, size_t* newpages)
+{
+    struct _buddy_region* r;
+    uint32_t idx;
+    int order, want, k;
+
+    for (r = _info.regions; r; r = r->link) {
+        if ((char*)ptr >= r->base &&
+            (char*)ptr < r->base + r->npages * _info.pagesize) {
+            break;
+        }
+    }
+    if (r == NULL) {
+        return 1;
+    }
+
+    idx = ((char*)ptr - r->base) / _info.pagesize;
+    order = r->state[idx] & _BUDDY_ORDER;
+    for (want = 0; ((size_t)1 << want) < *newpages; want++) {
+    }
+    if (want > r->maxorder) {
+        return -1;
+    }
 
     /*
-    * 'adjusted' is how much memory will actually
-    * be required to fulfill the size request.
+    * The block can only double in place while it is the lower half of
+    * its parent and the upper half is free and whole.
     */
-    adjusted = size + sizeof(struct _smalloc_pagegroup_t) +
-        sizeof(struct _smalloc_chunk_t);
+    for (k = order; k < want; k++) {
+        if ((idx & ((uint32_t)1 << k)) ||
+            r->state[idx + ((uint32_t)1 << k)] != (_BUDDY_FREE | k)) {
+            return -1;
+        }
+    }
+    for (k = order; k < want; k++) {
+        _buddy_unlink(r, k, idx + ((uint32_t)1 << k));
+        r->nfree -= (size_t)1 << k;
+    }
+    r->state[idx] = _BUDDY_USED | want;
+
+    _stats_begin();
+    _buddy_stats();
+    _stats_end();
+
+    *newpages = (size_t)1 << want;
+    return 0;
+}
+
+void
+_buddy_stats(void)
+{
+    struct _buddy_region* r;
+    size_t nfree, largest;
+    int k;
+
+    nfree = largest = 0;
+    for (r = _info.regions; r; r = r->link) {
+        nfree += r->nfree;
+        for (k = r->maxorder; k >= 0; k--) {
+            if (r->head[k] != _BUDDY_NIL) {
+                if (((size_t)1 << k) > largest) {
+                    largest = (size_t)1 << k;
+                }
+                break;
+            }
+        }
+    }
+
+    _info.stats.bytes_extent_free = nfree * _info.pagesize;
+    _info.stats.largest_extent_free = largest * _info.pagesize;
+}
+
+/* Marks pages [idx, idx + n) as one span in 'state'. */
+static void
+_span_mark(struct _span_region* r, uint32_t idx, uint32_t n, int state)
+{
+    r->len[idx] = r->len[idx + n - 1] = n;
+    r->state[idx] = r->state[idx + n - 1] = state;
+}
+
+static void
+_span_push(struct _span_region* r, uint32_t idx, uint32_t n)
+{
+    uint32_t list, at, before;
 
     /*
-    * If the page count requested will fit all of
-    * the adjusted size, no need to do more math.
-    *
-    * Otherwise, we need to figure out how many
-    * pages it will take to fit all of size.
+    * Keep every list in address order, the long list in length order
+    * first, so the head of the first list that fits is the best fit.
     */
-    npages = 0;
-    if (pcount * _info.pagesize >= adjusted) {
-        len = pcount * _info.pagesize;
-        npages = pcount;
+    list = n < _SPAN_NLISTS ? n : 0;
+    before = _BUDDY_NIL;
+    for (at = r->head[list]; at != _BUDDY_NIL; at = r->next[at]) {
+        if ((list == 0 && r->len[at] > n) ||
+            ((list != 0 || r->len[at] == n) && at > idx)) {
+            break;
+        }
+        before = at;
+    }
+
+    r->prev[idx] = before;
+    r->next[idx] = at;
+    if (before != _BUDDY_NIL) {
+        r->next[before] = idx;
     } else {
-        len = _info.pagesize * (adjusted / _info.pagesize);
-        len += _info.pagesize;
-        npages = len / _info.pagesize;
+        r->head[list] = idx;
+    }
+    if (at != _BUDDY_NIL) {
+        r->prev[at] = idx;
     }
+    r->nonempty[list / 64] |= (uint64_t)1 << (list % 64);
+    _span_mark(r, idx, n, _SPAN_FREE);
+}
 
-#ifdef SMALLOC_DEBUG
-    if (len % _info.pagesize != 0) {
-        fprintf(stderr, "ERROR: _pages_alloc: attempting improper page "
-            "alignment for mmap(2)\n");
+static void
+_span_unlink(struct _span_region* r, uint32_t idx)
+{
+    uint32_t list;
+
+    list = r->len[idx] < _SPAN_NLISTS ? r->len[idx] : 0;
+    if (r->prev[idx] != _BUDDY_NIL) {
+        r->next[r->prev[idx]] = r->next[idx];
+    } else {
+        r->head[list] = r->next[idx];
     }
-#endif
+    if (r->next[idx] != _BUDDY_NIL) {
+        r->prev[r->next[idx]] = r->prev[idx];
+    }
+    if (r->head[list] == _BUDDY_NIL) {
+        r->nonempty[list / 64] &= ~((uint64_t)1 << (list % 64));
+    }
+}
 
-#ifdef _WIN32
-    ret = HeapAlloc(_info.heap_ptr, 0, len);
-#else
-    ret = mmap(0, len, PROT_READ | PROT_WRITE,
-        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0L);
-#endif
+/* Returns the best fitting free span of at least 'n' pages, or NIL. */
+static uint32_t
+_span_fit(struct _span_region* r, uint32_t n)
+{
+    uint64_t bits;
+    uint32_t at;
+    size_t w;
 
-#ifdef SMALLOC_DEBUG
-    fprintf(stdout, "INFO: _pgroup_alloc: requested %lu bytes, %lu pages\n",
-        len, len / _info.pagesize);
-    if (!ret) {
-        fprintf(stderr, "ERROR: failed to allocate page group.\n");
+    for (w = n / 64; n < _SPAN_NLISTS && w < _SPAN_NLISTS / 64; w++) {
+        bits = r->nonempty[w];
+        if (w == n / 64) {
+            bits &= ~(uint64_t)0 << (n % 64);
+        }
+        if (bits) {
+            return r->head[w * 64 + __builtin_ctzll(bits)];
+        }
     }
-#endif
 
-    pg = (struct _smalloc_pagegroup_t*)ret;
-    pg->top = ret + sizeof(struct _smalloc_pagegroup_t);
-    pg->npages = npages;
-    pg->bytesfree = (pg->npages * _info.pagesize) -
-        sizeof(struct _smalloc_pagegroup_t);
-    pg->chunks = NULL;
-    pg->next = NULL;
+    for (at = r->head[0]; at != _BUDDY_NIL; at = r->next[at]) {
+        if (r->len[at] >= n) {
+            return at;
+        }
+    }
 
-    return pg;
+    return _BUDDY_NIL;
+}
+
+static struct _span_region*
+_span_region_new(void)
+{
+    struct _span_region* r;
+    size_t npages, metalen;
+    char* base;
+    char* meta;
+    int i;
+
+    npages = SMALLOC_REGION_SIZE / _info.pagesize;
+
+    metalen = sizeof(*r) + npages * (3 * sizeof(uint32_t) + 1);
+    base = _region_map(npages * _info.pagesize, &metalen, &meta);
+    if (base == NULL) {
+        return NULL;
+    }
+
+    r = (struct _span_region*)meta;
+    r->base = base;
+    r->npages = npages;
+    r->nfree = npages;
+    r->metalen = metalen;
+    r->next = (uint32_t*)(meta + sizeof(*r));
+    r->prev = r->next + npages;
+    r->len = r->prev + npages;
+    r->state = (unsigned char*)(r->len + npages);
+    r->link = NULL;
+    for (i = 0; i < _SPAN_NLISTS; i++) {
+        r->head[i] = _BUDDY_NIL;
+    }
+    memset(r->nonempty, 0, sizeof(r->nonempty));
+    _span_push(r, 0, npages);
+
+    _stats_begin();
+    _info.stats.bytes_reserved += npages * _info.pagesize;
+    _stats_end();
+
+    return r;
+}
+
+void*
+_span_alloc(size_t* npages)
+{
+    struct _span_region** link;
+    struct _span_region* r;
+    uint32_t idx, n, len;
+
+    for (link = &_info.spans; ; link = &r->link) {
+        r = *link;
+        if (r == NULL) {
+            r = *link = _span_region_new();
+            if (r == NULL) {
+                return NULL;
+            }
+        }
+        if (*npages > r->npages) {
+            return NULL;
+        }
+        n = *npages;
+
+        idx = _span_fit(r, n);
+        if (idx == _BUDDY_NIL) {
+            continue;
+        }
+
+        /* Use the front of the span and give the rest back. */
+        len = r->len[idx];
+        _span_unlink(r, idx);
+        if (len > n) {
+            _span_push(r, idx + n, len - n);
+        }
+        _span_mark(r, idx, n, _SPAN_USED);
+        r->nfree -= n;
+        break;
+    }
+
+    _stats_begin();
+    _span_stats();
+    _stats_end();
+
+    return r->base + (size_t)idx * _info.pagesize;
+}
+
+int
+_span_free(void* ptr)
+{
+    struct _span_region* r;
+    uint32_t idx, n, end;
+
+    for (r = _info.spans; r; r = r->link) {
+        if ((char*)ptr >= r->base &&
+            (char*)ptr < r->base + r->npages * _info.pagesize) {
+            break;
+        }
+    }
+    if (r == NULL) {
+        return -1;
+    }
+
+    idx = ((char*)ptr - r->base) / _info.pagesize;
+    n = r->len[idx];
+
+    _region_purge(ptr, (size_t)n * _info.pagesize);
+    r->nfree += n;
+
+    /* Coalesce with the free spans on either side. */
+    end = idx + n;
+    if (end < r->npages && r->state[end] == _SPAN_FREE) {
+        n += r->len[end];
+        _span_unlink(r, end);
+    }
+    if (idx > 0 && r->state[idx - 1] == _SPAN_FREE) {
+        idx -= r->len[idx - 1];
+        n += r->len[idx];
+        _span_unlink(r, idx);
+    }
+    _span_push(r, idx, n);
+
+    _stats_begin();
+    _span_stats();
+    _stats_end();
+
+    return 0;
+}
+
+int
+_span_grow(void* ptr, size_t* newpages)
+{
+    struct _span_region* r;
+    uint32_t idx, n, end, len, extra;
+
+    for (r = _info.spans; r; r = r->link) {
+        if ((char*)ptr >= r->base &&
+            (char*)ptr < r->base + r->npages * _info.pagesize) {
+            break;
+        }
+    }
+    if (r == NULL) {
+        return 1;
+    }
+
+    idx = ((char*)ptr - r->base) / _info.pagesize;
+    n = r->len[idx];
+    end = idx + n;
+    if (*newpages > r->npages - idx || end >= r->npages ||
+        r->state[end] != _SPAN_FREE || r->len[end] < *newpages - n) {
+        return -1;
+    }
+
+    /* Take the front of the free span after this one. */
+    extra = *newpages - n;
+    len = r->len[end];
+    _span_unlink(r, end);
+    if (len > extra) {
+        _span_push(r, end + extra, len - extra);
+    }
+    _span_mark(r, idx, n + extra, _SPAN_USED);
+    r->nfree -= extra;
+
+    _stats_begin();
+    _span_stats();
+    _stats_end();
+
+    return 0;
+}
+
+void
+_span_stats(void)
+{
+    struct _span_region* r;
+    size_t nfree, largest;
+    uint32_t at;
+    int list;
+
+    nfree = largest = 0;
+    for (r = _info.spans; r; r = r->link) {
+        nfree += r->nfree;
+        at = r->head[0];
+        while (at != _BUDDY_NIL && r->next[at] != _BUDDY_NIL) {
+            at = r->next[at];
+        }
+        if (at == _BUDDY_NIL) {
+            for (list = _SPAN_NLISTS - 1; list > 0; list--) {
+                if (r->head[list] != _BUDDY_NIL) {
+                    at = r->head[list];
+                    break;
+                }
+            }
+        }
+        if (at != _BUDDY_NIL && r->len[at] > largest) {
+            largest = r->len[at];
+        }
+    }
+
+    _info.stats.bytes_extent_free = nfree * _info.pagesize;
+    _info.stats.largest_extent_free = largest * _info.pagesize;
 }
+#endif
 
 int
-_pgroup_append(struct _smalloc_pagegroup_t* list, void* block)
+_pgroup_append(struct _smalloc_pagegroup_t** list, void* block)
 {
-    if (list->next) {
-        return _pgroup_append(list->next, block);
+    while (*list) {
+        list = &(*list)->next;
     }
 
-    list->next = (struct _smalloc_pagegroup_t*)block;
+    *list = (struct _smalloc_pagegroup_t*)block;
     return 0;
 }
 
@@ -339,17 +5861,97 @@ int
 _pgroup_fits(struct _smalloc_pagegroup_t* pg, size_t size)
 {
     /* we have to ensure we save space for the metadata when looking */
-    if (pg->bytesfree >= (size + sizeof(struct _smalloc_chunk_t))) {
+    if (pg->bytesfree >= _SMALLOC_CHKHDR_SIZE &&
+        pg->bytesfree - _SMALLOC_CHKHDR_SIZE >= size) {
         return 1;
     }
 
     return 0;
 }
 
+struct _smalloc_pagegroup_t*
+_pgroup_find(struct _smalloc_pagegroup_t* list, void* ptr)
+{
+    struct _smalloc_pagegroup_t* pg;
+    char* base;
+
+    for (pg = list; pg; pg = pg->next) {
+        base = (char*)pg;
+        if ((char*)ptr >= base + _SMALLOC_PGHDR_SIZE &&
+            (char*)ptr < base + pg->npages * _info.pagesize) {
+            return pg;
+        }
+    }
+
+    return NULL;
+}
+
+struct _smalloc_pagegroup_t*
+_pgroup_owner(void* ptr)
+{
+    struct _smalloc_pagegroup_t* pg;
+    struct smalloc_stack* st;
+
+    pg = _pagemap_get(ptr);
+    if (pg == NULL) {
+        pg = _pgroup_find(_info.pglist, ptr);
+    }
+    if (pg == NULL) {
+        pg = _pgroup_find(_info.slablist, ptr);
+    }
+    for (st = _info.heaps; st && pg == NULL; st = st->nextheap) {
+        pg = _pgroup_find(st->first, ptr);
+    }
+
+    return pg;
+}
+
 int
 _pgroup_cleanup(struct _smalloc_pagegroup_t* list)
 {
-    return -1;
+    struct _smalloc_pagegroup_t* pg;
+    int released;
+
+    if (list == NULL) {
+        return -1;
+    }
+
+    released = 0;
+    while ((pg = list->next) != NULL) {
+        if (pg->nlive == 0 && !_prefault_pinned(pg)) {
+            list->next = pg->next;
+            _pages_release(pg);
+            released++;
+        } else {
+            list = pg;
+        }
+    }
+
+    return released;
+}
+
+size_t
+_smalloc_usable_locked(void* ptr)
+{
+    struct _smalloc_pagegroup_t* pg;
+    struct _smalloc_chunk_t* chk;
+
+    pg = _pgroup_owner(ptr);
+    if (pg == NULL) {
+        pg = _pgroup_find(_info.inherited, ptr);
+        if (pg == NULL) {
+            return 0;
+        }
+    }
+    if (pg->kind == _SMALLOC_PG_SLAB) {
+        return pg->slotsize;
+    }
+    if (pg->kind == _SMALLOC_PG_STACK) {
+        return *(size_t*)((char*)ptr - _SMALLOC_HEAPHDR_SIZE);
+    }
+
+    chk = (struct _smalloc_chunk_t*)((char*)ptr - _SMALLOC_CHKHDR_SIZE);
+    return chk->len;
 }
 
 struct _smalloc_chunk_t*
@@ -357,35 +5959,50 @@ _pgroup_reserve(struct _smalloc_pagegroup_t* pg, size_t size)
 {
     struct _smalloc_chunk_t* chunk;
 
+#ifdef SMALLOC_DEBUG
     /* Sanity check. */
     assert(pg && (size != 0));
+#endif
 
     /*
     * Allocate the chunk, but let the calling function do
     * the initalization and cleanup on the chunks behalf.
     */
     chunk = (struct _smalloc_chunk_t*)pg->top;
-    chunk->next = NULL;
 
     /*
     * Make changes to our internal pagegroup structure to ensure accuracy.
     */
-    pg->top += (size + sizeof(struct _smalloc_chunk_t));
-    pg->bytesfree -= (size + sizeof(struct _smalloc_chunk_t));
+    pg->top += (size + _SMALLOC_CHKHDR_SIZE);
+    pg->bytesfree -= (size + _SMALLOC_CHKHDR_SIZE);
+    pg->nlive++;
+    if ((char*)pg->top - (char*)pg > pg->hiwater) {
+        pg->hiwater = (char*)pg->top - (char*)pg;
+    }
+    _stats_alloc(pg, size, 1);
 
-    /* Append the newly allocated chunk to the group's chunk list. */
-    if (pg->chunks == NULL) {
-        pg->chunks = chunk;
-    } else {
-        while (pg->chunks->next != NULL) {
-            pg->chunks = pg->chunks->next;
-        }
-        pg->chunks->next = chunk;
+#ifdef _SMALLOC_THREADS
+    /*
+    * Ask for the window to be topped up once half of it has been used,
+    * so the background thread stays ahead of the bump pointer.
+    */
+    if (_info.prefault_pages &&
+        pg->prefaulted < pg->npages * _info.pagesize &&
+        (char*)pg->top + _info.prefault_pages * _info.pagesize / 2 >
+        (char*)pg + pg->prefaulted) {
+        _prefault_request();
     }
+#endif
+
+#ifndef SMALLOC_COMPACT
+    /* Add the newly allocated chunk to the group's chunk list. */
+    chunk->next = pg->chunks;
+    pg->chunks = chunk;
+#endif
 
 #ifdef SMALLOC_DEBUG
     fprintf(stdout, "INFO: _pgroup_reserve: %lu bytes free in current "
-        " page group.\n", pg->bytesfree);
+        " page group.\n", (unsigned long)pg->bytesfree);
 #endif
 
     return chunk;
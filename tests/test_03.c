@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "smalloc.h"
+
+#define SMALLOC_COUNT       (1000)
+#define REQUEST_SIZE        (48)
+
+int main(int argc, char* argv[])
+{
+    int i;
+    void* ptrs[SMALLOC_COUNT];
+    void* first;
+
+    for (i = 0; i < SMALLOC_COUNT; i++) {
+        ptrs[i] = smalloc(REQUEST_SIZE);
+        if (ptrs[i] == NULL) {
+            fprintf(stderr, "TEST FAILED TO ALLOCATE MEMORY!\n");
+            return -1;
+        }
+        memset(ptrs[i], 0x3C, REQUEST_SIZE);
+    }
+    first = ptrs[0];
+
+    /* Hand half of them over one at a time and the rest in bulk. */
+    for (i = 0; i < SMALLOC_COUNT / 2; i++) {
+        sfree_async(ptrs[i]);
+    }
+    sfree_async_bulk(&ptrs[SMALLOC_COUNT / 2], SMALLOC_COUNT / 2);
+    sfree_async_flush();
+
+    /*
+    * Every chunk in the first page group is gone, so the group was reset
+    * and the next allocation lands back at its start.
+    */
+    ptrs[0] = smalloc(REQUEST_SIZE);
+    fprintf(stdout, "%p\n", first);
+    fprintf(stdout, "%p\n", ptrs[0]);
+    if (ptrs[0] != first) {
+        fprintf(stderr, "TEST FAILED: page group was not reclaimed!\n");
+        return -1;
+    }
+    sfree(ptrs[0]);
+
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "smalloc.h"
+
+#define THREAD_COUNT        (4)
+#define ROUNDS              (20000)
+#define REQUEST_SIZE        (64)
+#define LARGE_SIZE          (1024)
+
+static volatile int done;
+static volatile int torn;
+static volatile int unwritten;
+static size_t request_size;
+
+/*
+* Every chunk in a run is 'request_size' bytes, so any snapshot where
+* the byte count and the chunk count disagree was read mid-update.  The
+* snapshot is poisoned first to catch a read that gave up without
+* copying anything.
+*/
+static void* monitor(void* arg)
+{
+    struct smalloc_stats st, poison;
+
+    memset(&poison, 0xAA, sizeof(poison));
+    while (!done) {
+        st = poison;
+        smalloc_stats(&st);
+        if (st.bytes_mapped == poison.bytes_mapped) {
+            unwritten++;
+        }
+        if (st.bytes_allocated != st.nchunks * request_size) {
+            torn++;
+        }
+    }
+
+    return NULL;
+}
+
+static void* worker(void* arg)
+{
+    int i;
+    void* ptr;
+
+    for (i = 0; i < ROUNDS; i++) {
+        ptr = smalloc(request_size);
+        if (ptr == NULL) {
+            return (void*)1;
+        }
+        sfree(ptr);
+    }
+
+    return NULL;
+}
+
+/* Runs the workers on 'size' byte chunks while the monitor watches. */
+static int run(size_t size)
+{
+    pthread_t threads[THREAD_COUNT];
+    pthread_t watcher;
+    void* ret;
+    int i;
+
+    request_size = size;
+    done = 0;
+    pthread_create(&watcher, NULL, monitor, NULL);
+    for (i = 0; i < THREAD_COUNT; i++) {
+        pthread_create(&threads[i], NULL, worker, NULL);
+    }
+    for (i = 0; i < THREAD_COUNT; i++) {
+        pthread_join(threads[i], &ret);
+        if (ret != NULL) {
+            fprintf(stderr, "TEST FAILED TO ALLOCATE MEMORY!\n");
+            return -1;
+        }
+    }
+
+    done = 1;
+    pthread_join(watcher, NULL);
+    if (torn) {
+        fprintf(stderr, "TEST FAILED: %d torn stats snapshots!\n", torn);
+        return -1;
+    }
+    if (unwritten) {
+        fprintf(stderr, "TEST FAILED: %d stats snapshots never written!\n",
+            unwritten);
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    struct smalloc_stats st;
+    unsigned long acquisitions;
+    int i;
+
+    /* Slab objects are counted per arena, bigger chunks under the heap's. */
+    if (run(REQUEST_SIZE) || run(LARGE_SIZE)) {
+        return -1;
+    }
+
+    if (smalloc_stats(&st)) {
+        fprintf(stderr, "TEST FAILED TO READ STATS!\n");
+        return -1;
+    }
+
+    fprintf(stdout, "mapped %lu, allocated %lu, chunks %lu\n",
+        st.bytes_mapped, st.bytes_allocated, st.nchunks);
+    fprintf(stdout, "heap lock: %lu acquisitions, %lu contended, "
+        "%llu ns waiting\n", st.heap_lock.acquisitions,
+        st.heap_lock.contended, st.heap_lock.wait_ns);
+
+    /* Small objects only take their arena's lock. */
+    acquisitions = st.heap_lock.acquisitions;
+    for (i = 0; i < SMALLOC_STATS_NARENAS; i++) {
+        acquisitions += st.arena_lock[i].acquisitions;
+    }
+
+    if (st.nchunks != 0 || st.bytes_allocated != 0 ||
+        acquisitions < THREAD_COUNT * ROUNDS * 2) {
+        fprintf(stderr, "TEST FAILED: stats don't add up!\n");
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,56 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "smalloc.h"
+
+#define SMALLOC_COUNT       (100)
+#define REQUEST_SIZE        (100)
+#define SEGMENT_NAME        "/smalloc.test_05"
+
+int main(int argc, char* argv[])
+{
+    int i, fd;
+    void* ptrs[SMALLOC_COUNT];
+    struct smalloc_shm_segment* seg;
+
+    for (i = 0; i < SMALLOC_COUNT; i++) {
+        ptrs[i] = smalloc(REQUEST_SIZE);
+    }
+
+    if (smalloc_shm_export(SEGMENT_NAME, 10)) {
+        fprintf(stderr, "TEST FAILED TO EXPORT STATS!\n");
+        return -1;
+    }
+
+    /* Attach the way smalloc-top would and wait for a fresh publish. */
+    fd = shm_open(SEGMENT_NAME, O_RDONLY, 0);
+    seg = mmap(0, sizeof(*seg), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED || seg->magic != SMALLOC_SHM_MAGIC) {
+        fprintf(stderr, "TEST FAILED TO ATTACH TO THE SEGMENT!\n");
+        return -1;
+    }
+
+    for (i = 0; i < SMALLOC_COUNT; i++) {
+        sfree(ptrs[i]);
+    }
+    for (i = 0; i < 500 && seg->stats.nfrees < SMALLOC_COUNT; i++) {
+        usleep(10000);
+    }
+
+    fprintf(stdout, "pid %ld, rss %lu, allocs %llu, frees %llu, "
+        "live 128-byte class %lu\n", seg->pid, seg->rss_bytes,
+        seg->stats.nallocs, seg->stats.nfrees, seg->stats.nchunks_class[3]);
+
+    if (seg->stats.nallocs != SMALLOC_COUNT ||
+        seg->stats.nfrees != SMALLOC_COUNT || seg->rss_bytes == 0) {
+        fprintf(stderr, "TEST FAILED: segment was not updated!\n");
+        smalloc_shm_unexport();
+        return -1;
+    }
+
+    smalloc_shm_unexport();
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include <stdio.h>
+
+#include "smalloc.h"
+
+#define SMALLOC_COUNT       (20)
+#define REQUEST_SIZE        (256)
+#define TAG_PARSER          (3)
+#define TAG_PLANNER         (7)
+
+int main(int argc, char* argv[])
+{
+    int i;
+    void* parser[SMALLOC_COUNT];
+    void* planner[SMALLOC_COUNT];
+    void* plain;
+    struct smalloc_stats st;
+
+    plain = smalloc(REQUEST_SIZE);
+    for (i = 0; i < SMALLOC_COUNT; i++) {
+        parser[i] = smalloc_tagged(REQUEST_SIZE, TAG_PARSER);
+        planner[i] = smalloc_tagged(REQUEST_SIZE * 2, TAG_PLANNER);
+        if (parser[i] == NULL || planner[i] == NULL) {
+            fprintf(stderr, "TEST FAILED TO ALLOCATE MEMORY!\n");
+            return -1;
+        }
+    }
+
+    if (smalloc_tagged(REQUEST_SIZE, SMALLOC_STATS_NTAGS) != NULL) {
+        fprintf(stderr, "TEST FAILED: out of range tag was accepted!\n");
+        return -1;
+    }
+
+    smalloc_stats(&st);
+    fprintf(stdout, "untagged %lu, parser %lu, planner %lu\n",
+        st.bytes_tagged[0], st.bytes_tagged[TAG_PARSER],
+        st.bytes_tagged[TAG_PLANNER]);
+    if (st.bytes_tagged[0] != REQUEST_SIZE ||
+        st.bytes_tagged[TAG_PARSER] != SMALLOC_COUNT * REQUEST_SIZE ||
+        st.bytes_tagged[TAG_PLANNER] != SMALLOC_COUNT * REQUEST_SIZE * 2) {
+        fprintf(stderr, "TEST FAILED: tagged bytes don't add up!\n");
+        return -1;
+    }
+
+    /* The tag comes back from the page group, not from the caller. */
+    for (i = 0; i < SMALLOC_COUNT; i++) {
+        sfree(parser[i]);
+    }
+    sfree(plain);
+
+    smalloc_stats(&st);
+    fprintf(stdout, "untagged %lu, parser %lu, planner %lu\n",
+        st.bytes_tagged[0], st.bytes_tagged[TAG_PARSER],
+        st.bytes_tagged[TAG_PLANNER]);
+    if (st.bytes_tagged[0] != 0 || st.bytes_tagged[TAG_PARSER] != 0 ||
+        st.bytes_tagged[TAG_PLANNER] != SMALLOC_COUNT * REQUEST_SIZE * 2) {
+        fprintf(stderr, "TEST FAILED: frees were charged to the wrong "
+            "tag!\n");
+        return -1;
+    }
+
+    return 0;
+}
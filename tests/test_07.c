@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "smalloc.h"
+
+#define SMALLOC_COUNT       (64)
+#define REQUEST_SIZE        (128)
+
+int main(int argc, char* argv[])
+{
+    int i, status;
+    char* parent[SMALLOC_COUNT];
+    char* child;
+    pid_t pid;
+
+    for (i = 0; i < SMALLOC_COUNT; i++) {
+        parent[i] = smalloc(REQUEST_SIZE);
+        memset(parent[i], 'P', REQUEST_SIZE);
+    }
+
+    /* Make sure the reclaimer is running when we fork. */
+    sfree_async(parent[0]);
+    sfree_async_flush();
+
+    smalloc_set_fork_policy(SMALLOC_FORK_FRESH);
+
+    pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "TEST FAILED TO FORK!\n");
+        return -1;
+    }
+
+    if (pid == 0) {
+        /*
+        * Parent chunks must not be handed out again, even once the
+        * child has "freed" all of them.
+        */
+        for (i = 1; i < SMALLOC_COUNT; i++) {
+            sfree(parent[i]);
+        }
+        for (i = 0; i < SMALLOC_COUNT; i++) {
+            child = smalloc(REQUEST_SIZE);
+            if (child == NULL) {
+                _exit(1);
+            }
+            if (child >= parent[1] && child <= parent[SMALLOC_COUNT - 1]) {
+                _exit(2);
+            }
+            memset(child, 'C', REQUEST_SIZE);
+            sfree_async(child);
+        }
+        sfree_async_flush();
+
+        for (i = 1; i < SMALLOC_COUNT; i++) {
+            if (parent[i][0] != 'P') {
+                _exit(3);
+            }
+        }
+        _exit(0);
+    }
+
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "TEST FAILED: child exited with status %d!\n",
+            WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+        return -1;
+    }
+    fprintf(stdout, "child allocated from fresh page groups\n");
+
+    return 0;
+}
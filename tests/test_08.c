@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "smalloc.h"
+
+#define OBJECT_COUNT        (20000)
+#define REQUEST_SIZE        (16)
+#define FREE_STRIDE         (37)
+
+static int compare(const void* a, const void* b)
+{
+    char* x = *(char**)a;
+    char* y = *(char**)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Objects must be distinct and at least REQUEST_SIZE bytes apart. */
+static int check(void** ptrs, size_t n)
+{
+    void** sorted;
+    size_t i;
+
+    sorted = malloc(n * sizeof(void*));
+    memcpy(sorted, ptrs, n * sizeof(void*));
+    qsort(sorted, n, sizeof(void*), compare);
+    for (i = 1; i < n; i++) {
+        if ((char*)sorted[i] - (char*)sorted[i - 1] < REQUEST_SIZE) {
+            free(sorted);
+            return -1;
+        }
+    }
+    free(sorted);
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    static void* ptrs[OBJECT_COUNT];
+    static void* again[OBJECT_COUNT];
+    size_t i, n, nfreed;
+    int level, used;
+
+    for (level = SMALLOC_SIMD_AVX2; level >= SMALLOC_SIMD_SCALAR; level--) {
+        used = smalloc_set_simd(level);
+
+        n = smalloc_batch(REQUEST_SIZE, ptrs, OBJECT_COUNT);
+        if (n != OBJECT_COUNT || check(ptrs, n)) {
+            fprintf(stderr, "TEST FAILED: bad batch at level %d!\n", used);
+            return -1;
+        }
+        for (i = 0; i < n; i++) {
+            memset(ptrs[i], (int)i, REQUEST_SIZE);
+        }
+
+        /* Punch scattered holes and make sure the batch finds them all. */
+        nfreed = 0;
+        for (i = 0; i < n; i += FREE_STRIDE) {
+            sfree(ptrs[i]);
+            nfreed++;
+        }
+        if (smalloc_batch(REQUEST_SIZE, again, nfreed) != nfreed) {
+            fprintf(stderr, "TEST FAILED TO REFILL at level %d!\n", used);
+            return -1;
+        }
+        for (i = 0; i < nfreed; i++) {
+            ptrs[i * FREE_STRIDE] = again[i];
+        }
+        if (check(ptrs, n)) {
+            fprintf(stderr, "TEST FAILED: refill overlaps at level %d!\n",
+                used);
+            return -1;
+        }
+
+        fprintf(stdout, "simd level %d: %lu objects, %lu refilled\n", used,
+            n, nfreed);
+        for (i = 0; i < n; i++) {
+            sfree(ptrs[i]);
+        }
+    }
+
+    return 0;
+}
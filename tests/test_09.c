@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "smalloc.h"
+
+#define SMALL_SIZE          (40)
+#define CHUNK_SIZE          (1000)
+#define HUGE_SIZE           (96 * 1024 * 1024)
+
+static int is_zero(const char* p, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (p[i]) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int has_pattern(const unsigned char* p, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (p[i] != (unsigned char)(i * 7)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int main(int argc, char* argv[])
+{
+    char* a;
+    char* b;
+    unsigned char* grow;
+    size_t i, len;
+    const size_t sizes[] = {SMALL_SIZE, CHUNK_SIZE, 200000, HUGE_SIZE};
+
+    /* Dirty some memory, give it back, and make sure scalloc clears it. */
+    a = smalloc(CHUNK_SIZE);
+    memset(a, 0xFF, CHUNK_SIZE);
+    sfree(a);
+    b = scalloc(CHUNK_SIZE / 10, 10);
+    fprintf(stdout, "%p\n%p\n", a, b);
+    if (b == NULL || !is_zero(b, CHUNK_SIZE)) {
+        fprintf(stderr, "TEST FAILED: reused chunk was not cleared!\n");
+        return -1;
+    }
+
+    a = smalloc(SMALL_SIZE);
+    memset(a, 0xFF, SMALL_SIZE);
+    sfree(a);
+    a = scalloc(1, SMALL_SIZE);
+    if (a == NULL || !is_zero(a, SMALL_SIZE)) {
+        fprintf(stderr, "TEST FAILED: reused slot was not cleared!\n");
+        return -1;
+    }
+
+    a = scalloc(HUGE_SIZE, 1);
+    if (a == NULL || !is_zero(a, HUGE_SIZE)) {
+        fprintf(stderr, "TEST FAILED: huge block is not zeroed!\n");
+        return -1;
+    }
+    sfree(a);
+
+    if (scalloc((size_t)-1 / 2, 4) != NULL) {
+        fprintf(stderr, "TEST FAILED: scalloc overflow was not caught!\n");
+        return -1;
+    }
+
+    /* Grow one block through every size range, checking the contents. */
+    grow = NULL;
+    len = 0;
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        grow = srealloc(grow, sizes[i]);
+        if (grow == NULL || !has_pattern(grow, len)) {
+            fprintf(stderr, "TEST FAILED: srealloc to %lu lost data!\n",
+                sizes[i]);
+            return -1;
+        }
+        for (; len < sizes[i]; len++) {
+            grow[len] = (unsigned char)(len * 7);
+        }
+    }
+    if (srealloc(grow, 16) != grow || !has_pattern(grow, 16)) {
+        fprintf(stderr, "TEST FAILED: shrinking moved the block!\n");
+        return -1;
+    }
+    if (srealloc(grow, 0) != NULL) {
+        fprintf(stderr, "TEST FAILED: srealloc to zero didn't free!\n");
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "smalloc.h"
+
+#define REGION_SIZE         (64 * 1024 * 1024)
+#define POPULATE_THREADS    (4)
+
+int main(int argc, char* argv[])
+{
+    unsigned char* region;
+    unsigned char* vec;
+    char* hole;
+    size_t pagesize, npages, i, resident;
+
+    pagesize = sysconf(_SC_PAGESIZE);
+    npages = REGION_SIZE / pagesize;
+
+    region = smalloc(REGION_SIZE);
+    if (region == NULL) {
+        fprintf(stderr, "TEST FAILED TO ALLOCATE MEMORY!\n");
+        return -1;
+    }
+
+    /* A few pages already hold data that populating must not disturb. */
+    for (i = 0; i < REGION_SIZE; i += REGION_SIZE / 8) {
+        region[i] = 0xA5;
+    }
+
+    if (smalloc_populate(region, REGION_SIZE, POPULATE_THREADS)) {
+        fprintf(stderr, "TEST FAILED TO POPULATE!\n");
+        return -1;
+    }
+
+    for (i = 0; i < REGION_SIZE; i += REGION_SIZE / 8) {
+        if (region[i] != 0xA5 || region[i + 1] != 0) {
+            fprintf(stderr, "TEST FAILED: populate changed the data!\n");
+            return -1;
+        }
+    }
+
+    /* smalloc's chunk starts inside the first page; skip that page. */
+    vec = smalloc(npages);
+    mincore((void*)(((size_t)region + pagesize) & ~(pagesize - 1)),
+        REGION_SIZE - pagesize, vec);
+    resident = 0;
+    for (i = 0; i < npages - 1; i++) {
+        resident += vec[i] & 1;
+    }
+    fprintf(stdout, "%lu of %lu pages resident\n", resident, npages - 1);
+    if (resident != npages - 1) {
+        fprintf(stderr, "TEST FAILED: pages were not populated!\n");
+        return -1;
+    }
+
+    /* Ranges that aren't mapped writable fail instead of faulting. */
+    hole = mmap(NULL, 4 * pagesize, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    munmap(hole + 2 * pagesize, pagesize);
+    mprotect(hole, pagesize, PROT_NONE);
+    if (smalloc_populate(hole, 4 * pagesize, 1) == 0 ||
+        smalloc_populate(hole, pagesize, 1) == 0 ||
+        smalloc_populate(hole + 2 * pagesize, pagesize, 1) == 0) {
+        fprintf(stderr, "TEST FAILED: populated an inaccessible range!\n");
+        return -1;
+    }
+    if (smalloc_populate(hole + pagesize, pagesize, 1)) {
+        fprintf(stderr, "TEST FAILED TO POPULATE!\n");
+        return -1;
+    }
+
+    sfree(vec);
+    sfree(region);
+    return 0;
+}
@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "smalloc.h"
+
+#define WINDOW_PAGES        (4)
+#define REQUEST_SIZE        (1000)
+
+int main(int argc, char* argv[])
+{
+    unsigned char vec[WINDOW_PAGES + 1];
+    struct smalloc_stats st;
+    size_t pagesize, i;
+    char* group;
+    char* ptr;
+    int tries, resident;
+
+    pagesize = sysconf(_SC_PAGESIZE);
+
+    if (smalloc_set_prefault(WINDOW_PAGES)) {
+        fprintf(stderr, "TEST FAILED TO ENABLE PREFAULTING!\n");
+        return -1;
+    }
+
+    /*
+    * The first chunk of a fresh page group sits right after the group's
+    * header in its first page; the window covers the pages after it.
+    */
+    ptr = smalloc(REQUEST_SIZE);
+    memset(ptr, 1, REQUEST_SIZE);
+    group = (char*)((size_t)ptr & ~(pagesize - 1));
+
+    resident = 0;
+    for (tries = 0; tries < 200 && resident < WINDOW_PAGES; tries++) {
+        usleep(5000);
+        mincore(group, (WINDOW_PAGES + 1) * pagesize, vec);
+        resident = 0;
+        for (i = 1; i <= WINDOW_PAGES; i++) {
+            resident += vec[i] & 1;
+        }
+    }
+
+    smalloc_stats(&st);
+    fprintf(stdout, "%d of %d window pages resident, %llu prefaulted\n",
+        resident, WINDOW_PAGES, st.pages_prefaulted);
+    if (resident != WINDOW_PAGES || st.pages_prefaulted < WINDOW_PAGES) {
+        fprintf(stderr, "TEST FAILED: window was not prefaulted!\n");
+        return -1;
+    }
+
+    sfree(ptr);
+    return 0;
+}
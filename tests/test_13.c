@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "smalloc.h"
+
+#define NBLOCKS             (24)
+#define BASE_SIZE           (40000)
+#define STEP_SIZE           (13000)
+
+int main(int argc, char* argv[])
+{
+    struct smalloc_stats st;
+    char* ptrs[NBLOCKS];
+    size_t i, j;
+    char* head;
+
+    if (smalloc_set_backend(SMALLOC_BACKEND_SPAN)) {
+        fprintf(stderr, "TEST FAILED TO SELECT THE SPAN BACKEND!\n");
+        return -1;
+    }
+
+    /* The first page group stays around; give it something small. */
+    head = smalloc(100);
+
+    for (i = 0; i < NBLOCKS; i++) {
+        ptrs[i] = smalloc(BASE_SIZE + i * STEP_SIZE);
+        if (ptrs[i] == NULL) {
+            fprintf(stderr, "TEST FAILED: allocation %lu failed!\n", i);
+            return -1;
+        }
+        memset(ptrs[i], (int)i, BASE_SIZE + i * STEP_SIZE);
+    }
+
+    for (i = 0; i < NBLOCKS; i++) {
+        for (j = 0; j < BASE_SIZE + i * STEP_SIZE; j++) {
+            if (ptrs[i][j] != (char)i) {
+                fprintf(stderr, "TEST FAILED: block %lu was overwritten!\n",
+                    i);
+                return -1;
+            }
+        }
+    }
+
+    if (smalloc_set_backend(SMALLOC_BACKEND_MMAP) == 0) {
+        fprintf(stderr, "TEST FAILED: backend switched while in use!\n");
+        return -1;
+    }
+
+    /* Free every other block first so later frees coalesce both ways. */
+    for (i = 0; i < NBLOCKS; i += 2) {
+        sfree(ptrs[i]);
+    }
+    for (i = 1; i < NBLOCKS; i += 2) {
+        sfree(ptrs[i]);
+    }
+
+    smalloc_stats(&st);
+    fprintf(stdout, "%lu reserved, %lu free, largest free extent %lu\n",
+        st.bytes_reserved, st.bytes_extent_free, st.largest_extent_free);
+
+    /*
+    * Everything but the first group has coalesced back into the one span
+    * after it, and page groups took exactly the pages they asked for.
+    */
+    if (st.bytes_reserved == 0 ||
+        st.largest_extent_free != st.bytes_extent_free ||
+        st.bytes_reserved - st.bytes_extent_free != st.bytes_mapped) {
+        fprintf(stderr, "TEST FAILED: extents did not coalesce!\n");
+        return -1;
+    }
+
+    /* Released extents are handed out again zero filled. */
+    ptrs[0] = smalloc(BASE_SIZE);
+    for (j = 0; j < BASE_SIZE; j++) {
+        if (ptrs[0][j] != 0) {
+            fprintf(stderr, "TEST FAILED: reused extent was not zeroed!\n");
+            return -1;
+        }
+    }
+
+    sfree(ptrs[0]);
+    sfree(head);
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "smalloc.h"
+
+#define START_SIZE          (1 << 20)
+#define MAX_SIZE            (16 << 20)
+
+static int check(const char* p, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (p[i] != (char)(i % 251)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    struct smalloc_stats st;
+    char* first;
+    char* ptr;
+    char* grown;
+    size_t len, i;
+
+    if (smalloc_set_backend(SMALLOC_BACKEND_SPAN)) {
+        fprintf(stderr, "TEST FAILED TO SELECT THE SPAN BACKEND!\n");
+        return -1;
+    }
+
+    /* Keep the first page group, which is never released, out of it. */
+    first = smalloc(100);
+
+    ptr = smalloc(START_SIZE);
+    for (i = 0; i < START_SIZE; i++) {
+        ptr[i] = (char)(i % 251);
+    }
+
+    /*
+    * Nothing follows the block in its region, so every step should take
+    * the pages right after it and the block should never move.
+    */
+    for (len = START_SIZE; len < MAX_SIZE; len *= 2) {
+        grown = srealloc(ptr, len * 2);
+        if (grown != ptr) {
+            fprintf(stderr, "TEST FAILED: %lu byte block moved from %p to "
+                "%p!\n", len * 2, ptr, grown);
+            return -1;
+        }
+        for (i = len; i < len * 2; i++) {
+            ptr[i] = (char)(i % 251);
+        }
+    }
+
+    if (check(ptr, MAX_SIZE)) {
+        fprintf(stderr, "TEST FAILED: grown block lost its contents!\n");
+        return -1;
+    }
+
+    smalloc_stats(&st);
+    fprintf(stdout, "grew %p to %lu bytes in place, %lu bytes allocated\n",
+        ptr, (size_t)MAX_SIZE, st.bytes_allocated);
+    if (st.bytes_allocated < MAX_SIZE) {
+        fprintf(stderr, "TEST FAILED: growth was not accounted for!\n");
+        return -1;
+    }
+
+    /* Something after the block forces a copy, which must still work. */
+    grown = smalloc(START_SIZE);
+    ptr = srealloc(ptr, MAX_SIZE * 2);
+    if (ptr == NULL || check(ptr, MAX_SIZE)) {
+        fprintf(stderr, "TEST FAILED: copying growth lost contents!\n");
+        return -1;
+    }
+
+    sfree(grown);
+    sfree(ptr);
+    sfree(first);
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "smalloc.h"
+
+#define DEPTH               (6)
+#define PER_SCOPE           (200)
+#define OBJECT_SIZE         (1000)
+
+static char* first[DEPTH];
+
+/*
+* Fills each scope with objects, recursing into a deeper one halfway
+* through, and checks nothing in it was clobbered by the deeper scopes.
+* Remembers the first object of every scope.
+*/
+static int scope(struct smalloc_stack* st, int depth)
+{
+    struct smalloc_stack_mark mark;
+    char* objs[PER_SCOPE];
+    int i;
+
+    mark = smalloc_stack_mark(st);
+    for (i = 0; i < PER_SCOPE; i++) {
+        objs[i] = smalloc_stack_alloc(st, OBJECT_SIZE + depth);
+        if (objs[i] == NULL) {
+            return -1;
+        }
+        memset(objs[i], depth, OBJECT_SIZE + depth);
+        if (i == PER_SCOPE / 2 && depth + 1 < DEPTH &&
+            scope(st, depth + 1)) {
+            return -1;
+        }
+    }
+    first[depth] = objs[0];
+
+    for (i = 0; i < PER_SCOPE; i++) {
+        if (objs[i][0] != depth || objs[i][OBJECT_SIZE + depth - 1] != depth) {
+            return -1;
+        }
+    }
+    smalloc_stack_release(st, mark);
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    struct smalloc_stats before, after;
+    char* seen[DEPTH];
+    struct smalloc_stack* st;
+    int round;
+
+    st = smalloc_stack_create();
+    if (st == NULL) {
+        fprintf(stderr, "TEST FAILED TO CREATE A STACK!\n");
+        return -1;
+    }
+
+    for (round = 0; round < 3; round++) {
+        smalloc_stats(&before);
+        if (scope(st, 0)) {
+            fprintf(stderr, "TEST FAILED: scope contents were clobbered!\n");
+            return -1;
+        }
+        smalloc_stats(&after);
+        fprintf(stdout, "round %d: %lu page groups, %lu bytes mapped\n",
+            round, after.npagegroups, after.bytes_mapped);
+
+        /* Later rounds must run entirely in the pages of the first. */
+        if (round > 0 && (after.bytes_mapped != before.bytes_mapped ||
+            memcmp(seen, first, sizeof(seen)) != 0)) {
+            fprintf(stderr, "TEST FAILED: page groups were not reused!\n");
+            return -1;
+        }
+        memcpy(seen, first, sizeof(seen));
+    }
+
+    smalloc_stack_destroy(st);
+    smalloc_stats(&after);
+    if (after.npagegroups != 0 || after.bytes_mapped != 0) {
+        fprintf(stderr, "TEST FAILED: destroy leaked page groups!\n");
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "smalloc.h"
+
+#define FRAMES              (300)
+#define OBJECT_SIZE         (512)
+#define BURST_OBJECTS       (2000)
+#define QUIET_OBJECTS       (10)
+
+/*
+* Runs a loop of frames, most of them small with a burst in the middle,
+* checking that the previous frame's data survives the current one.
+* Returns the most memory mapped during the burst, or 0 on failure.
+*/
+static size_t frames(int check_shrink)
+{
+    struct smalloc_stats st;
+    char* prev[BURST_OBJECTS];
+    char* cur[BURST_OBJECTS];
+    size_t nprev, ncur, i, peak;
+    int frame;
+
+    nprev = 0;
+    peak = 0;
+    for (frame = 0; frame < FRAMES; frame++) {
+        ncur = frame == 10 ? BURST_OBJECTS : QUIET_OBJECTS;
+        for (i = 0; i < ncur; i++) {
+            cur[i] = smalloc_frame_alloc(OBJECT_SIZE);
+            if (cur[i] == NULL) {
+                return 0;
+            }
+            memset(cur[i], frame & 0x7f, OBJECT_SIZE);
+        }
+
+        for (i = 0; i < nprev; i++) {
+            if (prev[i][0] != ((frame - 1) & 0x7f) ||
+                prev[i][OBJECT_SIZE - 1] != ((frame - 1) & 0x7f)) {
+                fprintf(stderr, "frame %d clobbered frame %d\n", frame,
+                    frame - 1);
+                return 0;
+            }
+        }
+
+        smalloc_stats(&st);
+        if (st.bytes_mapped > peak) {
+            peak = st.bytes_mapped;
+        }
+
+        memcpy(prev, cur, ncur * sizeof(*cur));
+        nprev = ncur;
+        smalloc_frame_next();
+    }
+
+    /* By now the burst's extra pages have been quiet for a long time. */
+    smalloc_stats(&st);
+    fprintf(stdout, "%lu bytes mapped at the burst, %lu after\n", peak,
+        st.bytes_mapped);
+    if (check_shrink && st.bytes_mapped * 4 > peak) {
+        fprintf(stderr, "frame buffers did not shrink back\n");
+        return 0;
+    }
+
+    return peak;
+}
+
+static void* thread_main(void* arg)
+{
+    return frames(0) ? arg : NULL;
+}
+
+int main(int argc, char* argv[])
+{
+    struct smalloc_stats st;
+    pthread_t thread;
+    void* ret;
+
+    if (frames(1) == 0) {
+        fprintf(stderr, "TEST FAILED: frame allocator misbehaved!\n");
+        return -1;
+    }
+    smalloc_frame_free();
+
+    /* A thread's buffers go away with it. */
+    pthread_create(&thread, NULL, thread_main, &st);
+    pthread_join(thread, &ret);
+    smalloc_stats(&st);
+    if (ret == NULL || st.bytes_mapped != 0) {
+        fprintf(stderr, "TEST FAILED: thread exit left %lu bytes mapped!\n",
+            st.bytes_mapped);
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,149 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "smalloc.h"
+
+#define RING_SIZE           (64 * 1024)
+#define NMESSAGES           (200000)
+
+static struct smalloc_ring* ring;
+static char* volatile slots[NMESSAGES];
+
+static size_t msg_size(size_t i)
+{
+    return 1 + (i * 37) % 700;
+}
+
+/* Fills the ring with messages in order, waiting while it is full. */
+static void* producer(void* arg)
+{
+    size_t i;
+    char* p;
+
+    for (i = 0; i < NMESSAGES; i++) {
+        while ((p = smalloc_ring_alloc(ring, msg_size(i))) == NULL) {
+            sched_yield();
+        }
+        memset(p, (int)(i & 0xff), msg_size(i));
+        __atomic_store_n(&slots[i], p, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+/*
+* Allocates 1 KB messages, header included, until the ring is full, then
+* frees them all.  Returns how many bytes fit.
+*/
+static size_t fill(void)
+{
+    char* msgs[RING_SIZE / 1024 + 64];
+    size_t n, i;
+
+    for (n = 0; n < sizeof(msgs) / sizeof(*msgs); n++) {
+        msgs[n] = smalloc_ring_alloc(ring, 1024 - 16);
+        if (msgs[n] == NULL) {
+            break;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        smalloc_ring_free(ring, msgs[i]);
+    }
+
+    return n * 1024;
+}
+
+int main(int argc, char* argv[])
+{
+    struct smalloc_stats st;
+    pthread_t thread;
+    char* held;
+    char* a;
+    char* b;
+    char* c;
+    size_t i;
+    char* p;
+
+    ring = smalloc_ring_create(RING_SIZE);
+    if (ring == NULL) {
+        fprintf(stderr, "TEST FAILED TO CREATE A RING!\n");
+        return -1;
+    }
+
+    /* Out of order frees are reclaimed once the oldest one goes. */
+    a = smalloc_ring_alloc(ring, 100);
+    b = smalloc_ring_alloc(ring, 100);
+    c = smalloc_ring_alloc(ring, 100);
+    if (b != a + 128 || c != b + 128) {
+        fprintf(stderr, "TEST FAILED: messages are not contiguous!\n");
+        return -1;
+    }
+    smalloc_ring_free(ring, b);
+    smalloc_ring_free(ring, c);
+    smalloc_ring_free(ring, a);
+    if (fill() < RING_SIZE) {
+        fprintf(stderr, "TEST FAILED: ring space was not reclaimed!\n");
+        return -1;
+    }
+
+    /*
+    * One thread allocates while this one frees, mostly in order but
+    * holding back every seventh message for a while.
+    */
+    pthread_create(&thread, NULL, producer, NULL);
+    held = NULL;
+    for (i = 0; i < NMESSAGES; i++) {
+        while ((p = __atomic_load_n(&slots[i], __ATOMIC_ACQUIRE)) == NULL) {
+            sched_yield();
+        }
+        if (p[0] != (char)(i & 0xff) || p[msg_size(i) - 1] != (char)(i & 0xff)) {
+            fprintf(stderr, "TEST FAILED: message %lu was clobbered!\n", i);
+            return -1;
+        }
+        if (i % 7 == 0) {
+            smalloc_ring_free(ring, held);
+            held = p;
+        } else {
+            smalloc_ring_free(ring, p);
+        }
+    }
+    smalloc_ring_free(ring, held);
+    pthread_join(thread, NULL);
+
+    /* Everything is reclaimed, so the whole ring is free again. */
+    if (fill() < RING_SIZE) {
+        fprintf(stderr, "TEST FAILED: ring leaked space!\n");
+        return -1;
+    }
+
+    /*
+    * A message that doesn't fit before the end of an empty ring leaves
+    * a filler at the tail; freeing the message has to reclaim both.
+    */
+    for (i = 0; i < NMESSAGES / 100; i++) {
+        p = smalloc_ring_alloc(ring, 1100);
+        if (p == NULL) {
+            fprintf(stderr, "TEST FAILED: empty ring refused message %lu!\n",
+                i);
+            return -1;
+        }
+        smalloc_ring_free(ring, p);
+    }
+    if (smalloc_ring_alloc(ring, (size_t)-1) != NULL) {
+        fprintf(stderr, "TEST FAILED: ring took an oversize message!\n");
+        return -1;
+    }
+
+    smalloc_ring_destroy(ring);
+    smalloc_stats(&st);
+    fprintf(stdout, "%d messages passed, %lu bytes mapped after destroy\n",
+        NMESSAGES, st.bytes_mapped);
+    if (st.bytes_mapped != 0) {
+        fprintf(stderr, "TEST FAILED: destroy leaked the ring!\n");
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "smalloc.h"
+
+#define NFRAMES             (100)
+#define FRAME_SIZE          (250)
+
+static void* frames[NFRAMES];
+static int holding[2];
+static int release[2];
+
+/* Destroys every frame on a thread other than the one that made it. */
+static void* remote_free(void* arg)
+{
+    int i;
+
+    for (i = 0; i < NFRAMES; i++) {
+        smalloc_coro_free(frames[i]);
+    }
+
+    return NULL;
+}
+
+/* Allocates frames on a thread that exits while they are still out. */
+static void* orphan(void* arg)
+{
+    int i;
+
+    for (i = 0; i < NFRAMES; i++) {
+        frames[i] = smalloc_coro_alloc(FRAME_SIZE);
+    }
+
+    return NULL;
+}
+
+/*
+* Caches half of its frames and keeps the other half out, then waits
+* until told to exit.
+*/
+static void* holder(void* arg)
+{
+    char c = 0;
+    int i;
+
+    for (i = 0; i < NFRAMES; i++) {
+        frames[i] = smalloc_coro_alloc(FRAME_SIZE);
+    }
+    for (i = 0; i < NFRAMES / 2; i++) {
+        smalloc_coro_free(frames[i]);
+    }
+    if (write(holding[1], &c, 1) != 1 || read(release[0], &c, 1) != 1) {
+        return (void*)1;
+    }
+
+    return NULL;
+}
+
+/*
+* In a child forked while 'holder' is running, its cache is retired:
+* the cached frames are freed and the ones still out go to the heap.
+*/
+static int forked(void)
+{
+    struct smalloc_stats before, after;
+    pthread_t thread;
+    int i, status;
+    pid_t pid;
+    char c = 0;
+
+    if (pipe(holding) || pipe(release)) {
+        return -1;
+    }
+    pthread_create(&thread, NULL, holder, NULL);
+    if (read(holding[0], &c, 1) != 1) {
+        return -1;
+    }
+
+    smalloc_stats(&before);
+    pid = fork();
+    if (pid == 0) {
+        smalloc_stats(&after);
+        if (after.nfrees - before.nfrees != NFRAMES / 2) {
+            fprintf(stderr, "TEST FAILED: child kept a dead thread's "
+                "cache!\n");
+            _exit(1);
+        }
+        for (i = NFRAMES / 2; i < NFRAMES; i++) {
+            smalloc_coro_free(frames[i]);
+        }
+        smalloc_stats(&after);
+        _exit(after.nfrees - before.nfrees != NFRAMES);
+    }
+    if (write(release[1], &c, 1) != 1) {
+        return -1;
+    }
+    pthread_join(thread, NULL);
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || status != 0) {
+        fprintf(stderr, "TEST FAILED: forked child failed!\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    struct smalloc_stats before, after;
+    pthread_t thread;
+    void* big;
+    void* p;
+    int i;
+
+    /* A freed frame is the next one handed out in its size class. */
+    p = smalloc_coro_alloc(FRAME_SIZE);
+    memset(p, 1, FRAME_SIZE);
+    smalloc_coro_free(p);
+    if (smalloc_coro_alloc(FRAME_SIZE - 10) != p) {
+        fprintf(stderr, "TEST FAILED: frame was not cached!\n");
+        return -1;
+    }
+    smalloc_coro_free(p);
+
+    big = smalloc_coro_alloc(100000);
+    memset(big, 1, 100000);
+    smalloc_coro_free(big);
+
+    /*
+    * Frames destroyed on another thread come back to this thread's
+    * cache, and are reused without touching the heap.
+    */
+    for (i = 0; i < NFRAMES; i++) {
+        frames[i] = smalloc_coro_alloc(FRAME_SIZE);
+        memset(frames[i], 2, FRAME_SIZE);
+    }
+    pthread_create(&thread, NULL, remote_free, NULL);
+    pthread_join(thread, NULL);
+
+    smalloc_stats(&before);
+    for (i = 0; i < NFRAMES; i++) {
+        frames[i] = smalloc_coro_alloc(FRAME_SIZE);
+    }
+    smalloc_stats(&after);
+    fprintf(stdout, "%llu heap allocations for %d remotely freed frames\n",
+        after.nallocs - before.nallocs, NFRAMES);
+    if (after.nallocs != before.nallocs) {
+        fprintf(stderr, "TEST FAILED: remote frees were not reused!\n");
+        return -1;
+    }
+    for (i = 0; i < NFRAMES; i++) {
+        smalloc_coro_free(frames[i]);
+    }
+
+    /* Frames that outlive their thread go back to the heap. */
+    pthread_create(&thread, NULL, orphan, NULL);
+    pthread_join(thread, NULL);
+    smalloc_stats(&before);
+    for (i = 0; i < NFRAMES; i++) {
+        smalloc_coro_free(frames[i]);
+    }
+    smalloc_stats(&after);
+    if (after.nfrees - before.nfrees != NFRAMES) {
+        fprintf(stderr, "TEST FAILED: orphaned frames were not freed!\n");
+        return -1;
+    }
+
+    return forked();
+}
@@ -0,0 +1,74 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "smalloc.h"
+
+struct header {
+    size_t nkeys;
+    size_t nvalues;
+};
+
+int main(int argc, char* argv[])
+{
+    size_t sizes[4] = {sizeof(struct header), 3, 1000, 64 * 8};
+    size_t aligns[4] = {0, 1, 8, 256};
+    struct smalloc_stats before, after;
+    void* ptrs[4];
+    void* base;
+    size_t i;
+
+    smalloc_stats(&before);
+    base = smalloc_multi(sizes, aligns, 4, ptrs);
+    smalloc_stats(&after);
+    if (base == NULL || after.nallocs - before.nallocs != 1) {
+        fprintf(stderr, "TEST FAILED: expected exactly one allocation!\n");
+        return -1;
+    }
+
+    /* Every object is aligned, in order, and clear of its neighbours. */
+    for (i = 0; i < 4; i++) {
+        fprintf(stdout, "object %lu: %lu bytes at %p\n", i, sizes[i],
+            ptrs[i]);
+        if ((uintptr_t)ptrs[i] % (aligns[i] > 16 ? aligns[i] : 16) != 0 ||
+            (i > 0 && (char*)ptrs[i] < (char*)ptrs[i - 1] + sizes[i - 1])) {
+            fprintf(stderr, "TEST FAILED: object %lu misplaced!\n", i);
+            return -1;
+        }
+        memset(ptrs[i], (int)i + 1, sizes[i]);
+    }
+    if ((char*)ptrs[3] - (char*)ptrs[0] > 2048) {
+        fprintf(stderr, "TEST FAILED: objects are not packed!\n");
+        return -1;
+    }
+    for (i = 0; i < 4; i++) {
+        if (((char*)ptrs[i])[0] != (char)(i + 1) ||
+            ((char*)ptrs[i])[sizes[i] - 1] != (char)(i + 1)) {
+            fprintf(stderr, "TEST FAILED: object %lu overlapped!\n", i);
+            return -1;
+        }
+    }
+
+    sfree(base);
+    smalloc_stats(&after);
+    if (after.nfrees - before.nfrees != 1 || after.bytes_allocated != 0) {
+        fprintf(stderr, "TEST FAILED: one sfree() did not release all!\n");
+        return -1;
+    }
+
+    /* Bad alignments are refused. */
+    aligns[2] = 24;
+    if (smalloc_multi(sizes, aligns, 4, ptrs) != NULL) {
+        fprintf(stderr, "TEST FAILED: accepted a bad alignment!\n");
+        return -1;
+    }
+
+    /* Even ones below the usual alignment, which would be raised to it. */
+    aligns[2] = 12;
+    if (smalloc_multi(sizes, aligns, 4, ptrs) != NULL) {
+        fprintf(stderr, "TEST FAILED: accepted a bad small alignment!\n");
+        return -1;
+    }
+
+    return 0;
+}
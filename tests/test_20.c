@@ -0,0 +1,144 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "smalloc.h"
+
+#define NOBJECTS            (64)
+#define OBJECT_SIZE         (20000)
+#define SMALL_SIZE          (48)
+
+static char* objs[NOBJECTS];
+static char* other;
+
+static void* other_thread(void* arg)
+{
+    other = smalloc(SMALL_SIZE);
+    return NULL;
+}
+
+static int check(int i, int value)
+{
+    return objs[i][0] == value && objs[i][OBJECT_SIZE - 1] == value;
+}
+
+int main(int argc, char* argv[])
+{
+    struct smalloc_stats before, during, after;
+    pthread_t thread;
+    char* later;
+    char* small;
+    int i;
+
+    if (smalloc_set_backend(SMALLOC_BACKEND_SPAN | SMALLOC_BACKEND_MEMFD)) {
+        fprintf(stderr, "TEST FAILED TO SELECT A MEMFD BACKEND!\n");
+        return -1;
+    }
+    if (smalloc_arena_rollback() == 0) {
+        fprintf(stderr, "TEST FAILED: rolled back without a snapshot!\n");
+        return -1;
+    }
+
+    for (i = 0; i < NOBJECTS; i++) {
+        objs[i] = smalloc(OBJECT_SIZE);
+        memset(objs[i], 1, OBJECT_SIZE);
+    }
+
+    smalloc_stats(&before);
+    if (smalloc_arena_snapshot()) {
+        fprintf(stderr, "TEST FAILED TO TAKE A SNAPSHOT!\n");
+        return -1;
+    }
+
+    /* Scribble on, free and allocate past the restore point... */
+    for (i = 0; i < NOBJECTS; i++) {
+        if (i % 2) {
+            memset(objs[i], 2, OBJECT_SIZE);
+        } else {
+            sfree(objs[i]);
+        }
+    }
+    later = smalloc(10 * OBJECT_SIZE);
+    memset(later, 3, 10 * OBJECT_SIZE);
+    smalloc_stats(&during);
+
+    /* ...and all of it is undone. */
+    if (smalloc_arena_rollback()) {
+        fprintf(stderr, "TEST FAILED TO ROLL BACK!\n");
+        return -1;
+    }
+    smalloc_stats(&after);
+    fprintf(stdout, "allocated: %lu at the snapshot, %lu after changes, "
+        "%lu after rollback\n", before.bytes_allocated,
+        during.bytes_allocated, after.bytes_allocated);
+    for (i = 0; i < NOBJECTS; i++) {
+        if (!check(i, 1)) {
+            fprintf(stderr, "TEST FAILED: object %d was not restored!\n", i);
+            return -1;
+        }
+    }
+    if (after.bytes_allocated != before.bytes_allocated ||
+        after.nchunks != before.nchunks) {
+        fprintf(stderr, "TEST FAILED: allocations were not restored!\n");
+        return -1;
+    }
+
+    /* The heap works normally from the restored state. */
+    for (i = 0; i < NOBJECTS; i += 2) {
+        sfree(objs[i]);
+        objs[i] = smalloc(OBJECT_SIZE);
+        memset(objs[i], 4, OBJECT_SIZE);
+    }
+
+    /* Committing keeps the changes; there's nothing to roll back to. */
+    if (smalloc_arena_commit() || smalloc_arena_rollback() == 0) {
+        fprintf(stderr, "TEST FAILED: commit misbehaved!\n");
+        return -1;
+    }
+    for (i = 0; i < NOBJECTS; i++) {
+        if (!check(i, i % 2 ? 1 : 4)) {
+            fprintf(stderr, "TEST FAILED: commit lost object %d!\n", i);
+            return -1;
+        }
+        memset(objs[i], 5, OBJECT_SIZE);
+    }
+    for (i = 0; i < NOBJECTS; i++) {
+        if (!check(i, 5)) {
+            fprintf(stderr, "TEST FAILED: heap is not writable after "
+                "commit!\n");
+            return -1;
+        }
+        sfree(objs[i]);
+    }
+
+    /*
+    * Have another thread leave a slab in a second arena, then drop that
+    * arena after a snapshot.  Rolling back must not hand the slab back
+    * to the arena that is no longer used.
+    */
+    smalloc_set_arenas(2);
+    small = smalloc(16);
+    pthread_create(&thread, NULL, other_thread, NULL);
+    pthread_join(thread, NULL);
+    if (other == NULL || smalloc_arena_snapshot()) {
+        fprintf(stderr, "TEST FAILED TO TAKE A SNAPSHOT!\n");
+        return -1;
+    }
+    smalloc_set_arenas(1);
+    if (smalloc_arena_rollback()) {
+        fprintf(stderr, "TEST FAILED TO ROLL BACK!\n");
+        return -1;
+    }
+    later = smalloc(SMALL_SIZE);
+    if (later == NULL || later < other || later >= other + 4096) {
+        fprintf(stderr, "TEST FAILED: rollback stranded a slab in a "
+            "dropped arena!\n");
+        return -1;
+    }
+    sfree(later);
+    sfree(other);
+    sfree(small);
+    smalloc_set_arenas(0);
+
+    return 0;
+}
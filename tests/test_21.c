@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "smalloc.h"
+
+/* Stands in for library code that knows nothing about request heaps. */
+static char* library_call(size_t n)
+{
+    char* buf;
+    char* tmp;
+
+    tmp = smalloc(100);
+    buf = scalloc(n, 1);
+    buf = srealloc(buf, n * 4);
+    memset(buf + n, 7, n * 3);
+    sfree(tmp);
+
+    return buf;
+}
+
+int main(int argc, char* argv[])
+{
+    struct smalloc_stats before, after;
+    struct smalloc_stack* request;
+    struct smalloc_stack* inner;
+    struct smalloc_stack_mark mark;
+    char* normal;
+    char* outer;
+    char* nested;
+    char* back;
+    char* grown;
+    char* async[2];
+    size_t i;
+
+    request = smalloc_stack_create();
+    inner = smalloc_stack_create();
+    normal = smalloc(100);
+    mark = smalloc_stack_mark(request);
+
+    /* Everything a request allocates lands in its heap... */
+    smalloc_stats(&before);
+    if (smalloc_thread_set_heap(request) != NULL) {
+        fprintf(stderr, "TEST FAILED: a heap was already set!\n");
+        return -1;
+    }
+    outer = library_call(1000);
+
+    /* ...and nested scopes get theirs, then hand back to the outer one. */
+    if (smalloc_thread_set_heap(inner) != request) {
+        fprintf(stderr, "TEST FAILED: nesting lost the outer heap!\n");
+        return -1;
+    }
+    nested = library_call(500);
+
+    /* Objects of the outer heap still belong to it in a nested scope. */
+    grown = srealloc(outer, 8000);
+    if (grown == NULL || grown[999] != 0 || grown[1000] != 7) {
+        fprintf(stderr, "TEST FAILED: outer heap object lost in a nested "
+            "scope!\n");
+        return -1;
+    }
+    sfree(grown);
+    sfree(outer);
+    if (smalloc_tagged(64, SMALLOC_STATS_NTAGS) != NULL) {
+        fprintf(stderr, "TEST FAILED: a bad tag was accepted!\n");
+        return -1;
+    }
+    smalloc_thread_set_heap(request);
+    back = smalloc(64);
+
+    /* Deferred frees leave the heap's objects to it as well. */
+    async[0] = smalloc(64);
+    async[1] = smalloc(64);
+    memset(async[0], 9, 64);
+    memset(async[1], 9, 64);
+    sfree_async(async[0]);
+    sfree_async_bulk((void**)async, 2);
+    sfree_async_flush();
+    smalloc_thread_set_heap(NULL);
+    smalloc_stats(&after);
+
+    fprintf(stdout, "%llu heap allocations during the request\n",
+        after.nallocs - before.nallocs);
+    if (after.nallocs != before.nallocs) {
+        fprintf(stderr, "TEST FAILED: request allocations hit the heap!\n");
+        return -1;
+    }
+    for (i = 0; i < 1000; i++) {
+        if (outer[i] != 0 || outer[1000 + i] != 7) {
+            fprintf(stderr, "TEST FAILED: library buffer corrupted!\n");
+            return -1;
+        }
+    }
+    if (async[0][0] != 9 || async[1][0] != 9) {
+        fprintf(stderr, "TEST FAILED: a deferred free reached the "
+            "reclaimer!\n");
+        return -1;
+    }
+    if (nested[0] != 0 || nested[1999] != 7 ||
+        (back > outer && back < outer + 4000)) {
+        fprintf(stderr, "TEST FAILED: nested heap misbehaved!\n");
+        return -1;
+    }
+
+    /* The request is released in bulk; the heap is back to normal. */
+    smalloc_stack_release(request, mark);
+    smalloc_stack_destroy(inner);
+    smalloc_stack_destroy(request);
+    sfree(normal);
+    normal = smalloc(100);
+    smalloc_stats(&after);
+    if (normal == NULL || after.nallocs != before.nallocs + 1) {
+        fprintf(stderr, "TEST FAILED: heap did not come back!\n");
+        return -1;
+    }
+    sfree(normal);
+
+    return 0;
+}
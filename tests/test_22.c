@@ -0,0 +1,154 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+
+#include "smalloc.h"
+
+#define THREAD_COUNT        (4)
+#define OBJECTS             (1000)
+#define OBJECT_SIZE         (48)
+
+static void* objects[THREAD_COUNT][OBJECTS];
+static volatile int started;
+static volatile int release;
+
+static void* worker(void* arg)
+{
+    void** mine = arg;
+    int i;
+
+    for (i = 0; i < OBJECTS; i++) {
+        mine[i] = smalloc(OBJECT_SIZE);
+        if (mine[i] == NULL) {
+            return (void*)1;
+        }
+    }
+
+    __sync_fetch_and_add(&started, 1);
+    while (!release) {
+        sched_yield();
+    }
+
+    return NULL;
+}
+
+static size_t threads_mapped(const struct smalloc_stats* st)
+{
+    size_t n = 0;
+    int i;
+
+    for (i = 0; i < SMALLOC_STATS_NARENAS; i++) {
+        n += st->arena_threads[i];
+    }
+
+    return n;
+}
+
+int main(int argc, char* argv[])
+{
+    pthread_t threads[THREAD_COUNT];
+    struct smalloc_stats st;
+    size_t mapped;
+    void* ret;
+    void* ptr;
+    int i, j;
+
+    if (smalloc_set_arenas(SMALLOC_STATS_NARENAS + 1) != -1 ||
+        smalloc_set_arenas(THREAD_COUNT)) {
+        fprintf(stderr, "TEST FAILED: smalloc_set_arenas!\n");
+        return -1;
+    }
+
+    /* Start the threads one at a time so each finds its own arena. */
+    for (i = 0; i < THREAD_COUNT; i++) {
+        pthread_create(&threads[i], NULL, worker, objects[i]);
+        while (started == i) {
+            sched_yield();
+        }
+    }
+
+    smalloc_stats(&st);
+    if (st.narenas != THREAD_COUNT || threads_mapped(&st) != THREAD_COUNT ||
+        st.nchunks != THREAD_COUNT * OBJECTS) {
+        fprintf(stderr, "TEST FAILED: %u arenas, %lu threads, %lu chunks!\n",
+            st.narenas, threads_mapped(&st), st.nchunks);
+        return -1;
+    }
+    for (i = 0; i < THREAD_COUNT; i++) {
+        if (st.arena_threads[i] != 1 || st.arena_lock[i].acquisitions == 0) {
+            fprintf(stderr, "TEST FAILED: arena %d has %lu threads!\n", i,
+                st.arena_threads[i]);
+            return -1;
+        }
+    }
+
+    release = 1;
+    for (i = 0; i < THREAD_COUNT; i++) {
+        pthread_join(threads[i], &ret);
+        if (ret != NULL) {
+            fprintf(stderr, "TEST FAILED TO ALLOCATE MEMORY!\n");
+            return -1;
+        }
+    }
+    smalloc_stats(&st);
+    if (threads_mapped(&st) != 0) {
+        fprintf(stderr, "TEST FAILED: exited threads still mapped!\n");
+        return -1;
+    }
+
+    /*
+    * Consolidate into one arena, then free the other threads' objects
+    * and allocate them again: the slabs of the dropped arenas must be
+    * reused rather than new ones mapped.
+    */
+    if (smalloc_set_arenas(1)) {
+        fprintf(stderr, "TEST FAILED: smalloc_set_arenas(1)!\n");
+        return -1;
+    }
+    smalloc_stats(&st);
+    mapped = st.bytes_mapped;
+    for (i = 0; i < THREAD_COUNT; i++) {
+        for (j = 0; j < OBJECTS; j++) {
+            sfree(objects[i][j]);
+        }
+    }
+    smalloc_stats(&st);
+    if (st.nchunks != 0 || st.bytes_allocated != 0) {
+        fprintf(stderr, "TEST FAILED: %lu chunks left!\n", st.nchunks);
+        return -1;
+    }
+
+    for (i = 0; i < THREAD_COUNT; i++) {
+        for (j = 0; j < OBJECTS; j++) {
+            objects[i][j] = smalloc(OBJECT_SIZE);
+        }
+    }
+    smalloc_stats(&st);
+    if (st.narenas != 1 || st.arena_threads[0] != 1 ||
+        threads_mapped(&st) != 1 || st.bytes_mapped != mapped) {
+        fprintf(stderr, "TEST FAILED: %u arenas, %lu threads, mapped %lu "
+            "(was %lu)!\n", st.narenas, threads_mapped(&st),
+            st.bytes_mapped, mapped);
+        return -1;
+    }
+    for (i = 0; i < THREAD_COUNT; i++) {
+        for (j = 0; j < OBJECTS; j++) {
+            sfree(objects[i][j]);
+        }
+    }
+
+    /* Back to following contention. */
+    if (smalloc_set_arenas(0)) {
+        fprintf(stderr, "TEST FAILED: smalloc_set_arenas(0)!\n");
+        return -1;
+    }
+    ptr = smalloc(OBJECT_SIZE);
+    sfree(ptr);
+    smalloc_stats(&st);
+    if (st.nchunks != 0) {
+        fprintf(stderr, "TEST FAILED: %lu chunks left!\n", st.nchunks);
+        return -1;
+    }
+
+    return 0;
+}
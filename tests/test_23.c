@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "smalloc.h"
+
+#define SMALL_COUNT         (20000)
+#define SMALL_SIZE          (16)
+#define LARGE_COUNT         (1000)
+#define LARGE_SIZE          (256)
+
+static void* small[SMALL_COUNT];
+static void* large[LARGE_COUNT];
+
+int main(int argc, char* argv[])
+{
+    struct smalloc_stats st;
+    size_t mapped, groups;
+    unsigned long long purged;
+    char* p;
+    int i, j;
+
+    smalloc_set_decay(60000);
+
+    for (i = 0; i < SMALL_COUNT; i++) {
+        small[i] = smalloc(SMALL_SIZE);
+        if (small[i] == NULL) {
+            fprintf(stderr, "TEST FAILED TO ALLOCATE MEMORY!\n");
+            return -1;
+        }
+        memset(small[i], 0x5A, SMALL_SIZE);
+    }
+    for (i = 0; i < SMALL_COUNT; i++) {
+        sfree(small[i]);
+    }
+
+    /* Every slab but the class's last one went to the pool, still dirty. */
+    smalloc_stats(&st);
+    mapped = st.bytes_mapped;
+    groups = st.npagegroups;
+    fprintf(stdout, "mapped %lu, %lu groups, pooled %lu, dirty %lu\n",
+        st.bytes_mapped, st.npagegroups, st.bytes_pooled,
+        st.bytes_pooled_dirty);
+    if (st.bytes_pooled == 0 || st.bytes_pooled_dirty != st.bytes_pooled) {
+        fprintf(stderr, "TEST FAILED: empty slabs were not pooled!\n");
+        return -1;
+    }
+
+    /* Another size class takes them over without mapping anything. */
+    for (i = 0; i < LARGE_COUNT; i++) {
+        large[i] = smalloc(LARGE_SIZE);
+        if (large[i] == NULL) {
+            fprintf(stderr, "TEST FAILED TO ALLOCATE MEMORY!\n");
+            return -1;
+        }
+        memset(large[i], 0xA5, LARGE_SIZE);
+    }
+    smalloc_stats(&st);
+    fprintf(stdout, "mapped %lu, %lu groups, pooled %lu\n", st.bytes_mapped,
+        st.npagegroups, st.bytes_pooled);
+    if (st.bytes_mapped != mapped || st.npagegroups != groups) {
+        fprintf(stderr, "TEST FAILED: pooled slabs were not reused!\n");
+        return -1;
+    }
+    for (i = 0; i < LARGE_COUNT; i++) {
+        sfree(large[i]);
+    }
+
+    /* With no decay time everything waiting is purged at once. */
+    purged = st.npurged;
+    smalloc_set_decay(0);
+    smalloc_stats(&st);
+    fprintf(stdout, "pooled %lu, dirty %lu, %llu purged\n", st.bytes_pooled,
+        st.bytes_pooled_dirty, st.npurged - purged);
+    if (st.bytes_pooled == 0 || st.bytes_pooled_dirty != 0 ||
+        st.npurged == purged) {
+        fprintf(stderr, "TEST FAILED: pooled slabs were not purged!\n");
+        return -1;
+    }
+
+    /* Purged slabs come back zeroed and usable. */
+    for (i = 0; i < LARGE_COUNT; i++) {
+        p = scalloc(1, LARGE_SIZE);
+        if (p == NULL) {
+            fprintf(stderr, "TEST FAILED TO ALLOCATE MEMORY!\n");
+            return -1;
+        }
+        for (j = 0; j < LARGE_SIZE; j++) {
+            if (p[j]) {
+                fprintf(stderr, "TEST FAILED: memory was not zeroed!\n");
+                return -1;
+            }
+        }
+        large[i] = p;
+    }
+    for (i = 0; i < LARGE_COUNT; i++) {
+        sfree(large[i]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "smalloc.h"
+
+/* Requests near the top of size_t must fail rather than wrap. */
+static const size_t huge[] = {
+    (size_t)-1, (size_t)-8, (size_t)-16, (size_t)-4096, (size_t)-65536, ((size_t)-1 >> 1) + 1
+};
+
+#define HUGE_COUNT          (sizeof(huge) / sizeof(huge[0]))
+
+int main(int argc, char* argv[])
+{
+    struct smalloc_stack* st;
+    char* small;
+    void* p;
+    size_t i;
+
+    /* Leave a page group around for a wrapped size to fit into. */
+    small = smalloc(100);
+    if (small == NULL) {
+        fprintf(stderr, "TEST FAILED TO ALLOCATE MEMORY!\n");
+        return -1;
+    }
+    memset(small, 0x5A, 100);
+    st = smalloc_stack_create();
+    if (st == NULL) {
+        fprintf(stderr, "TEST FAILED TO ALLOCATE MEMORY!\n");
+        return -1;
+    }
+
+    for (i = 0; i < HUGE_COUNT; i++) {
+        p = smalloc(huge[i]);
+        if (p != NULL) {
+            fprintf(stderr, "TEST FAILED: smalloc(%lu) returned %p!\n",
+                huge[i], p);
+            return -1;
+        }
+        p = scalloc(1, huge[i]);
+        if (p != NULL) {
+            fprintf(stderr, "TEST FAILED: scalloc(1, %lu) returned %p!\n",
+                huge[i], p);
+            return -1;
+        }
+        if (smalloc_batch(huge[i], &p, 1) != 0) {
+            fprintf(stderr, "TEST FAILED: smalloc_batch(%lu) succeeded!\n",
+                huge[i]);
+            return -1;
+        }
+        p = smalloc_stack_alloc(st, huge[i]);
+        if (p != NULL) {
+            fprintf(stderr, "TEST FAILED: smalloc_stack_alloc(%lu) returned "
+                "%p!\n", huge[i], p);
+            return -1;
+        }
+        p = smalloc_coro_alloc(huge[i]);
+        if (p != NULL) {
+            fprintf(stderr, "TEST FAILED: smalloc_coro_alloc(%lu) returned "
+                "%p!\n", huge[i], p);
+            return -1;
+        }
+        p = srealloc(small, huge[i]);
+        if (p != NULL) {
+            fprintf(stderr, "TEST FAILED: srealloc(%p, %lu) returned %p!\n",
+                (void*)small, huge[i], p);
+            return -1;
+        }
+    }
+
+    /* The heap is still intact afterwards. */
+    p = smalloc(1000);
+    if (p == NULL) {
+        fprintf(stderr, "TEST FAILED TO ALLOCATE MEMORY!\n");
+        return -1;
+    }
+    memset(p, 0xA5, 1000);
+    for (i = 0; i < 100; i++) {
+        if (small[i] != 0x5A) {
+            fprintf(stderr, "TEST FAILED: heap was corrupted!\n");
+            return -1;
+        }
+    }
+    sfree(p);
+    sfree(small);
+    smalloc_stack_destroy(st);
+
+    return 0;
+}
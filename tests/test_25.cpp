@@ -0,0 +1,98 @@
+#include <coroutine>
+#include <cstdio>
+#include <exception>
+
+#include "smalloc_coro.hpp"
+
+#define NCORO               (10000)
+
+/* A lazily started coroutine returning an int. */
+template <class Promise>
+struct task {
+    typedef Promise promise_type;
+
+    std::coroutine_handle<Promise> h;
+
+    explicit task(std::coroutine_handle<Promise> h) : h(h) {}
+    task(task&& other) : h(other.h) { other.h = nullptr; }
+    ~task()
+    {
+        if (h) {
+            h.destroy();
+        }
+    }
+
+    int get()
+    {
+        h.resume();
+        return h.promise().value;
+    }
+};
+
+template <class Promise>
+struct int_promise {
+    int value;
+
+    task<Promise> get_return_object()
+    {
+        return task<Promise>(std::coroutine_handle<Promise>::from_promise(
+            static_cast<Promise&>(*this)));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_value(int v) { value = v; }
+    void unhandled_exception() { std::terminate(); }
+};
+
+/* Throws std::bad_alloc if the frame can't be allocated. */
+struct throwing_promise : smalloc_coro_frame,
+    int_promise<throwing_promise> {
+};
+
+/* Returns an empty task instead. */
+struct nothrow_promise : smalloc_coro_frame_nothrow,
+    int_promise<nothrow_promise> {
+    static task<nothrow_promise> get_return_object_on_allocation_failure()
+    {
+        return task<nothrow_promise>(nullptr);
+    }
+};
+
+static task<throwing_promise> add(int a, int b)
+{
+    co_return a + b;
+}
+
+static task<nothrow_promise> mul(int a, int b)
+{
+    co_return a * b;
+}
+
+int main(int argc, char* argv[])
+{
+    int i;
+
+    for (i = 0; i < NCORO; i++) {
+        task<throwing_promise> t = add(i, 1);
+        if (t.get() != i + 1) {
+            fprintf(stderr, "TEST FAILED: coroutine %d returned the wrong "
+                "value!\n", i);
+            return -1;
+        }
+    }
+
+    for (i = 0; i < NCORO; i++) {
+        task<nothrow_promise> t = mul(i, 2);
+        if (!t.h) {
+            fprintf(stderr, "TEST FAILED TO ALLOCATE A FRAME!\n");
+            return -1;
+        }
+        if (t.get() != i * 2) {
+            fprintf(stderr, "TEST FAILED: coroutine %d returned the wrong "
+                "value!\n", i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "smalloc.h"
+
+#define WINDOW_PAGES        (131072)
+#define OLD_SIZE            ((size_t)256 << 20)
+#define NEW_SIZE            ((size_t)512 << 20)
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE (0x100000)
+#endif
+
+int main(int argc, char* argv[])
+{
+    size_t pagesize;
+    char* guard;
+    char* want;
+    char* ptr;
+    char* ret;
+
+    pagesize = sysconf(_SC_PAGESIZE);
+
+    if (smalloc_set_prefault(WINDOW_PAGES)) {
+        fprintf(stderr, "TEST FAILED TO ENABLE PREFAULTING!\n");
+        return -1;
+    }
+
+    /*
+    * The reclaimer spends a while populating a group this size.  Growing
+    * it in the meantime must not move it out from under the reclaimer,
+    * so block it from growing in place to make srealloc want to move it.
+    */
+    ptr = smalloc(OLD_SIZE);
+    if (ptr == NULL) {
+        fprintf(stderr, "TEST FAILED TO ALLOCATE MEMORY!\n");
+        return -1;
+    }
+    ptr[0] = 0x5A;
+    ptr[OLD_SIZE - 1] = 0xA5;
+
+    /*
+    * New mappings usually go just below the last one, in which case the
+    * page after the block is taken already.
+    */
+    want = (char*)(((size_t)ptr + OLD_SIZE + pagesize - 1) & ~(pagesize - 1));
+    guard = mmap(want, pagesize, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (guard == MAP_FAILED && errno != EEXIST) {
+        fprintf(stderr, "TEST FAILED TO MAP A PAGE AFTER THE BLOCK!\n");
+        return -1;
+    }
+    if (guard != MAP_FAILED && guard != want) {
+        fprintf(stderr, "TEST FAILED: kernel ignored MAP_FIXED_NOREPLACE!\n");
+        return -1;
+    }
+
+    ret = srealloc(ptr, NEW_SIZE);
+    if (ret == NULL) {
+        fprintf(stderr, "TEST FAILED TO GROW THE BLOCK!\n");
+        return -1;
+    }
+    if (ret[0] != 0x5A || ret[OLD_SIZE - 1] != (char)0xA5) {
+        fprintf(stderr, "TEST FAILED: contents were not preserved!\n");
+        return -1;
+    }
+
+    /* Let the reclaimer finish with whatever it had pinned. */
+    usleep(500000);
+    ret[NEW_SIZE - 1] = 1;
+    sfree(ret);
+    if (guard != MAP_FAILED) {
+        munmap(guard, pagesize);
+    }
+
+    return 0;
+}
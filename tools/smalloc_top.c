@@ -0,0 +1,224 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "smalloc.h"
+
+/*
+* smalloc-top attaches to the shared memory segment a process publishes
+* with smalloc_shm_export() and redraws its allocator statistics every
+* time the process publishes them.
+*
+* usage: smalloc-top [-1] <pid | /segment-name>
+*
+* -1 - print a single snapshot and exit instead of refreshing.
+*/
+
+static const char* usage = "usage: smalloc-top [-1] <pid | /segment-name>\n";
+
+/*
+* Copies the segment into 'out' following the sequence lock protocol.
+* Gives up and returns -1 if the writer never lets go, which only
+* happens if the process died in the middle of a publish.
+*/
+static int snapshot(const struct smalloc_shm_segment* seg,
+    struct smalloc_shm_segment* out)
+{
+    unsigned seq;
+    int tries;
+
+    for (tries = 0; tries < 1000000; tries++) {
+        seq = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        memcpy(out, (const void*)seg, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (seq == seg->seq) {
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static const char* human(size_t bytes, char* buf, size_t len)
+{
+    const char* units[] = {"B", "K", "M", "G", "T"};
+    double value = (double)bytes;
+    int u = 0;
+
+    while (value >= 1024.0 && u < 4) {
+        value /= 1024.0;
+        u++;
+    }
+    snprintf(buf, len, u ? "%.1f%s" : "%.0f%s", value, units[u]);
+
+    return buf;
+}
+
+static void display(const struct smalloc_shm_segment* cur,
+    const struct smalloc_shm_segment* prev, int clear)
+{
+    const struct smalloc_stats* st = &cur->stats;
+    const struct smalloc_lock_stats* lk = &st->heap_lock;
+    char b1[32], b2[32], b3[32];
+    double secs, allocs, frees;
+    size_t limit;
+    int i;
+
+    allocs = frees = 0.0;
+    if (prev && cur->timestamp_ns > prev->timestamp_ns) {
+        secs = (cur->timestamp_ns - prev->timestamp_ns) / 1e9;
+        allocs = (st->nallocs - prev->stats.nallocs) / secs;
+        frees = (st->nfrees - prev->stats.nfrees) / secs;
+    }
+
+    if (clear) {
+        fprintf(stdout, "\033[H\033[J");
+    }
+    fprintf(stdout, "smalloc-top - pid %ld, every %u ms\n\n",
+        cur->pid, cur->interval_ms);
+    fprintf(stdout, "rss %8s   mapped %8s   allocated %8s   "
+        "page groups %lu\n", human(cur->rss_bytes, b1, sizeof(b1)),
+        human(st->bytes_mapped, b2, sizeof(b2)),
+        human(st->bytes_allocated, b3, sizeof(b3)), st->npagegroups);
+    fprintf(stdout, "allocs %llu (%.0f/s)   frees %llu (%.0f/s)\n",
+        st->nallocs, allocs, st->nfrees, frees);
+    fprintf(stdout, "purged %llu page groups, %s   prefaulted %llu pages\n",
+        st->npurged, human(st->bytes_purged, b1, sizeof(b1)),
+        st->pages_prefaulted);
+    if (st->bytes_reserved) {
+        fprintf(stdout, "reserved %8s   extents free %8s   largest %8s\n",
+            human(st->bytes_reserved, b1, sizeof(b1)),
+            human(st->bytes_extent_free, b2, sizeof(b2)),
+            human(st->largest_extent_free, b3, sizeof(b3)));
+    }
+    fprintf(stdout, "pooled %8s   dirty %8s\n",
+        human(st->bytes_pooled, b1, sizeof(b1)),
+        human(st->bytes_pooled_dirty, b2, sizeof(b2)));
+    fprintf(stdout, "heap lock: %lu acquisitions, %lu contended (%.2f%%), "
+        "avg wait %.0f ns\n\n", lk->acquisitions, lk->contended,
+        lk->acquisitions ? 100.0 * lk->contended / lk->acquisitions : 0.0,
+        lk->contended ? (double)lk->wait_ns / lk->contended : 0.0);
+
+    fprintf(stdout, "%10s %8s %14s %12s %9s\n", "arena", "threads",
+        "acquisitions", "contended", "avg wait");
+    for (i = 0; i < SMALLOC_STATS_NARENAS; i++) {
+        lk = &st->arena_lock[i];
+        if ((unsigned)i >= st->narenas && st->arena_threads[i] == 0) {
+            continue;
+        }
+        fprintf(stdout, "%9d%s %8lu %14lu %11.2f%% %6.0f ns\n", i,
+            (unsigned)i < st->narenas ? " " : "*", st->arena_threads[i],
+            lk->acquisitions,
+            lk->acquisitions ? 100.0 * lk->contended / lk->acquisitions : 0.0,
+            lk->contended ? (double)lk->wait_ns / lk->contended : 0.0);
+    }
+    fprintf(stdout, "\n");
+
+    fprintf(stdout, "%10s %12s\n", "size <=", "live chunks");
+    limit = 16;
+    for (i = 0; i < SMALLOC_STATS_NCLASSES; i++) {
+        if (i == SMALLOC_STATS_NCLASSES - 1) {
+            fprintf(stdout, "%10s %12lu\n", "larger", st->nchunks_class[i]);
+        } else {
+            fprintf(stdout, "%10s %12lu\n", human(limit, b1, sizeof(b1)),
+                st->nchunks_class[i]);
+        }
+        limit <<= 1;
+    }
+
+    fprintf(stdout, "\n%10s %12s\n", "tag", "allocated");
+    for (i = 0; i < SMALLOC_STATS_NTAGS; i++) {
+        if (st->bytes_tagged[i]) {
+            fprintf(stdout, "%10d %12s\n", i,
+                human(st->bytes_tagged[i], b1, sizeof(b1)));
+        }
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+    struct smalloc_shm_segment* seg;
+    struct smalloc_shm_segment cur, prev;
+    struct stat sb;
+    const char* target;
+    char name[64];
+    char* end;
+    long pid;
+    int fd, once, have_prev;
+
+    once = 0;
+    target = NULL;
+    if (argc == 3 && strcmp(argv[1], "-1") == 0) {
+        once = 1;
+        target = argv[2];
+    } else if (argc == 2) {
+        target = argv[1];
+    } else {
+        fprintf(stderr, "%s", usage);
+        return 1;
+    }
+
+    pid = strtol(target, &end, 10);
+    if (*target != '\0' && *end == '\0') {
+        snprintf(name, sizeof(name), SMALLOC_SHM_NAME_FMT, pid);
+    } else {
+        snprintf(name, sizeof(name), "%s", target);
+    }
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "smalloc-top: can't open %s: %s\n", name,
+            strerror(errno));
+        return 1;
+    }
+    /* A shorter segment from an older layout would fault when mapped. */
+    if (fstat(fd, &sb) < 0 || (size_t)sb.st_size < sizeof(*seg)) {
+        fprintf(stderr, "smalloc-top: %s is not a smalloc statistics "
+            "segment this viewer understands\n", name);
+        close(fd);
+        return 1;
+    }
+    seg = mmap(0, sizeof(*seg), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED) {
+        fprintf(stderr, "smalloc-top: can't map %s: %s\n", name,
+            strerror(errno));
+        return 1;
+    }
+    if (seg->magic != SMALLOC_SHM_MAGIC || seg->version != SMALLOC_SHM_VERSION) {
+        fprintf(stderr, "smalloc-top: %s is not a smalloc statistics "
+            "segment this viewer understands\n", name);
+        return 1;
+    }
+
+    have_prev = 0;
+    for (;;) {
+        if (snapshot(seg, &cur)) {
+            fprintf(stderr, "smalloc-top: segment is stuck mid-update\n");
+            return 1;
+        }
+        display(&cur, have_prev ? &prev : NULL, !once);
+        if (once) {
+            break;
+        }
+
+        if (kill((pid_t)cur.pid, 0) && errno == ESRCH) {
+            fprintf(stdout, "\nprocess %ld has exited\n", cur.pid);
+            break;
+        }
+        prev = cur;
+        have_prev = 1;
+        usleep(cur.interval_ms * 1000);
+    }
+
+    munmap(seg, sizeof(*seg));
+    return 0;
+}